@@ -33,11 +33,7 @@ def graph(name, data_point, include_naive=False):
 graph("average", lambda box: box["average"])
 graph("insert", lambda box: box["children"]["insert"]["average"])
 graph("collision", lambda box: box["children"]["collision"]["average"])
-def query(box):
-    children = box["children"]["collision"]["children"]
-    if "query" in children:
-        return children["query"]["average"]
-    return 0.0
-graph("query", query)
+graph("find pairs", lambda box: box["children"]["collision"]["children"]["find pairs"]["average"])
+graph("parallel collision", lambda box: box["children"]["parallel collision"]["average"])
 
 # graph("naive", lambda box: box["average"], True)
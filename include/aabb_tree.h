@@ -0,0 +1,62 @@
+#pragma once
+
+#include "box.h"
+#include "ds.h"
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+#define AABB_TREE_NULL UINT32_MAX
+
+typedef struct AabbTreeNode AabbTreeNode;
+struct AabbTreeNode {
+    // Fattened box for leaves, union of the children otherwise.
+    Box box;
+    // Next free node while on the free list.
+    uint32_t parent;
+    uint32_t left;
+    uint32_t right;
+    // Zero for leaves, -1 for free nodes.
+    int32_t height;
+    // Leaves only.
+    uint32_t id;
+};
+
+// Dynamic bounding volume hierarchy. Every box is stored once in a leaf,
+// leaves are placed by the surface area heuristic and the tree is kept
+// balanced with rotations. There's no world area and no depth limit.
+typedef struct AabbTree AabbTree;
+struct AabbTree {
+    Vec(AabbTreeNode) nodes;
+    uint32_t root;
+    uint32_t free_list;
+
+    // Leaf of every id, 'AABB_TREE_NULL' if it has none.
+    Vec(uint32_t) leaves;
+    // Exact box of every id, the leaves only hold the fattened ones.
+    Vec(Box) boxes;
+
+    float margin;
+};
+
+typedef struct AabbTreeDesc AabbTreeDesc;
+struct AabbTreeDesc {
+    // Leaves are grown by this much on every side, so boxes moving less than
+    // that don't touch the tree on update.
+    float margin;
+};
+
+extern AabbTree* aabb_tree_new(const AabbTreeDesc* desc);
+extern void aabb_tree_free(AabbTree *tree);
+
+extern void aabb_tree_insert(AabbTree *tree, uint32_t id, Box box);
+extern void aabb_tree_update(AabbTree *tree, uint32_t id, Box box);
+extern void aabb_tree_remove(AabbTree *tree, uint32_t id);
+extern void aabb_tree_clear(AabbTree *tree);
+
+extern Vec(uint32_t) aabb_tree_query(const AabbTree* tree, Box area);
+extern void aabb_tree_query_into(const AabbTree* tree, Box area, Vec(uint32_t)* result);
+extern bool aabb_tree_query_visit(const AabbTree* tree, Box area, BoxVisitFunc func, void* user_data);
+extern void aabb_tree_find_pairs(const AabbTree* tree, Vec(BoxPair)* pairs);
+
+extern void aabb_tree_debug_draw(const AabbTree* tree, SDL_Renderer *renderer);
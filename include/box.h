@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "vec2.h"
 
@@ -10,7 +11,36 @@ struct Box {
     Vec2 size;
 };
 
+// A box tagged with the caller's handle, which is what the strategies store.
+typedef struct BoxEntry BoxEntry;
+struct BoxEntry {
+    Box box;
+    uint32_t id;
+};
+
+// Two overlapping entries, ordered so that 'a < b'.
+typedef struct BoxPair BoxPair;
+struct BoxPair {
+    uint32_t a;
+    uint32_t b;
+};
+
 extern Box box(float x, float y, float w, float h);
 extern bool box_eq(Box a, Box b);
 
 extern bool box_overlapp(Box a, Box b);
+extern bool box_contains_point(Box box, Vec2 point);
+// Whether 'inner' lies completely inside 'outer'.
+extern bool box_contains(Box outer, Box inner);
+// Top left corner of the overlapping region of two boxes. Every structure
+// storing a box in all cells it covers has exactly one cell containing this
+// point for a given pair, which is used to report each pair only once.
+extern Vec2 box_overlapp_min(Box a, Box b);
+// Smallest box containing both boxes.
+extern Box box_union(Box a, Box b);
+
+extern BoxPair box_pair(uint32_t a, uint32_t b);
+
+// Called for every candidate found by a visiting query. Return true to stop
+// the query early.
+typedef bool (*BoxVisitFunc)(void* user_data, uint32_t id, Box box);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "box.h"
+#include "vec2.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+// Shared by the strategies storing boxes in cells.
+
+// Half open range of cells covered by a box.
+typedef struct CellRange CellRange;
+struct CellRange {
+    int32_t min_x, min_y;
+    int32_t max_x, max_y;
+};
+
+// Cells of 'cell_size' covered by 'box', with cell (0, 0) starting at
+// 'origin'.
+static inline CellRange cell_range(Box box, Vec2 origin, Vec2 cell_size) {
+    Vec2 min = vec2_div(vec2_sub(box.pos, origin), cell_size);
+    Vec2 max = vec2_div(vec2_sub(vec2_add(box.pos, box.size), origin), cell_size);
+    return (CellRange) {
+        .min_x = floorf(min.x),
+        .min_y = floorf(min.y),
+        .max_x = ceilf(max.x),
+        .max_y = ceilf(max.y),
+    };
+}
+
+static inline bool cell_range_eq(CellRange a, CellRange b) {
+    return a.min_x == b.min_x && a.min_y == b.min_y &&
+        a.max_x == b.max_x && a.max_y == b.max_y;
+}
+
+// Row major key with the sign bits flipped, so sorting the keys as unsigned
+// integers orders cells by y then x.
+static inline uint64_t cell_key(int32_t x, int32_t y) {
+    return ((uint64_t) ((uint32_t) y ^ 0x80000000) << 32) | ((uint32_t) x ^ 0x80000000);
+}
+
+// https://stackoverflow.com/questions/664014/what-integer-hash-function-are-good-that-accepts-an-integer-hash-key
+static inline uint64_t cell_hash(uint64_t key) {
+    key = (key ^ (key >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    key = (key ^ (key >> 27)) * UINT64_C(0x94d049bb133111eb);
+    key = key ^ (key >> 31);
+    return key;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "box.h"
+#include "ds.h"
+#include "strategy_interface.h"
+#include "thread_pool.h"
+
+#include <stdint.h>
+
+// Boxes queried by one task.
+#define COLLISION_DRIVER_CHUNK_SIZE 64
+
+// Runs a batch of queries against any strategy on a thread pool. Queries only
+// read the strategy, so every thread can query the same one. Each chunk of
+// queries writes to its own buffer and the buffers are joined in chunk order,
+// so the results don't depend on the number of threads. All buffers are
+// kept between batches.
+typedef struct CollisionDriver CollisionDriver;
+struct CollisionDriver {
+    ThreadPool *pool;
+
+    // Candidates of the current query, one buffer per thread.
+    Vec(uint32_t)* candidates;
+    // Results of every chunk.
+    Vec(BoxPair)* chunk_pairs;
+    Vec(uint32_t)* chunk_ids;
+    uint32_t chunk_capacity;
+};
+
+extern CollisionDriver* collision_driver_new(ThreadPool *pool);
+extern void collision_driver_free(CollisionDriver *driver);
+
+// Candidates of every area, in the layout of 'csr_grid': the ones of area 'i'
+// are 'ids[starts[i]]' up to 'ids[starts[i+1]]'. Both are overwritten.
+extern void collision_driver_query(CollisionDriver *driver, const Strategy* strat, const void* data, const Box* areas, uint32_t count, Vec(uint32_t)* starts, Vec(uint32_t)* ids);
+// Appends every overlapping pair exactly once, found by querying with every
+// box. The boxes have to be inserted with their index as id.
+extern void collision_driver_find_pairs(CollisionDriver *driver, const Strategy* strat, const void* data, const Box* boxes, uint32_t count, Vec(BoxPair)* pairs);
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "box.h"
+#include "quadtree.h"
+#include "ds.h"
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+// Bounds the traversal stack so queries don't have to allocate it, and keeps
+// the Morton path plus depth within a 64 bit key. Deeper levels would be
+// smaller than float precision for any sensible area anyway.
+#define COMPACT_QUADTREE_MAX_DEPTH 28
+
+// Sort key of an item: the Morton path of its node, padded to the full depth,
+// followed by the node's depth in the low byte. Sorting by it lays the items
+// out in pre-order.
+typedef struct MortonItem MortonItem;
+struct MortonItem {
+    uint64_t key;
+    uint32_t index;
+};
+
+// Node bounds aren't stored, they're derived from the root area while
+// traversing. Items are laid out in pre-order, so a node's own items are
+// followed by the items of its whole subtree.
+typedef struct CompactQuadtreeNode CompactQuadtreeNode;
+struct CompactQuadtreeNode {
+    // Index of the first of four consecutive children, 0 for leaves.
+    uint32_t first_child;
+    // Items stored at this node, the ones straddling its children.
+    uint32_t item_start;
+    uint32_t item_count;
+    // End of the items of the whole subtree.
+    uint32_t item_end;
+};
+
+// Quadtree built in bulk from the inserted boxes. Every box is stored once,
+// in the deepest node fully containing it, and nodes only hold indices into
+// a separate packed item array. 'build' radix sorts the items by Morton key
+// and derives the nodes from the ranges of the sorted keys.
+typedef struct CompactQuadtree CompactQuadtree;
+struct CompactQuadtree {
+    Box area;
+    uint32_t max_depth;
+    uint32_t max_box_count;
+
+    Vec(CompactQuadtreeNode) nodes;
+    Vec(BoxEntry) items;
+    // Ids of 'items' in the same order, so whole subtrees can be copied out
+    // at once.
+    Vec(uint32_t) item_ids;
+    Vec(BoxEntry) scratch;
+    Vec(MortonItem) keys;
+    Vec(MortonItem) keys_back;
+};
+
+extern CompactQuadtree* compact_quadtree_new(const QuadtreeDesc* desc);
+extern void compact_quadtree_free(CompactQuadtree *quadtree);
+
+extern void compact_quadtree_insert(CompactQuadtree *quadtree, uint32_t id, Box box);
+extern void compact_quadtree_build(CompactQuadtree *quadtree);
+extern void compact_quadtree_clear(CompactQuadtree *quadtree);
+
+extern Vec(uint32_t) compact_quadtree_query(const CompactQuadtree* quadtree, Box area);
+extern void compact_quadtree_query_into(const CompactQuadtree* quadtree, Box area, Vec(uint32_t)* result);
+extern bool compact_quadtree_query_visit(const CompactQuadtree* quadtree, Box area, BoxVisitFunc func, void* user_data);
+extern void compact_quadtree_find_pairs(const CompactQuadtree* quadtree, Vec(BoxPair)* pairs);
+
+extern void compact_quadtree_debug_draw(const CompactQuadtree* quadtree, SDL_Renderer *renderer);
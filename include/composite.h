@@ -0,0 +1,81 @@
+#pragma once
+
+#include "box.h"
+#include "ds.h"
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+// Defined in 'strategy_interface.h', which includes this header.
+typedef struct Strategy Strategy;
+
+enum CompositeLayer {
+    COMPOSITE_NONE,
+    COMPOSITE_STATIC,
+    COMPOSITE_DYNAMIC,
+};
+typedef enum CompositeLayer CompositeLayer;
+
+// Decides the layer of a box inserted through the strategy interface.
+typedef bool (*CompositeIsStaticFunc)(void* user_data, uint32_t id, Box box);
+
+typedef struct CompositeDesc CompositeDesc;
+struct CompositeDesc {
+    const Strategy* static_strategy;
+    const void* static_desc;
+    const Strategy* dynamic_strategy;
+    const void* dynamic_desc;
+
+    // Everything goes to the dynamic layer without it.
+    CompositeIsStaticFunc is_static;
+    void* user_data;
+};
+
+// Two strategies behind one: a static layer for boxes that never move and a
+// dynamic layer for the rest. The static layer survives 'clear', static ids
+// inserted again are skipped and it's only built again after it changed, so
+// the work per frame only grows with the dynamic boxes. Queries and pairs
+// cover both layers.
+typedef struct Composite Composite;
+struct Composite {
+    const Strategy* static_strategy;
+    void* static_data;
+    const Strategy* dynamic_strategy;
+    void* dynamic_data;
+
+    CompositeIsStaticFunc is_static;
+    void* user_data;
+
+    // Layer and box of every id.
+    Vec(uint8_t) layers;
+    Vec(Box) boxes;
+    // Ids in the dynamic layer and their index in there, for pairing them
+    // with the static layer.
+    Vec(uint32_t) dynamic_ids;
+    Vec(uint32_t) dynamic_slots;
+
+    // Pairs within the static layer, found again only when it changed.
+    Vec(BoxPair) static_pairs;
+    bool static_dirty;
+};
+
+extern Composite* composite_new(const CompositeDesc* desc);
+extern void composite_free(Composite *composite);
+
+// Inserts into the layer picked by 'is_static'.
+extern void composite_insert(Composite *composite, uint32_t id, Box box);
+// An id already in the other layer is removed from there first.
+extern void composite_insert_layer(Composite *composite, uint32_t id, Box box, CompositeLayer layer);
+extern void composite_update(Composite *composite, uint32_t id, Box box);
+extern void composite_remove(Composite *composite, uint32_t id);
+// Only clears the dynamic layer.
+extern void composite_clear(Composite *composite);
+extern void composite_clear_static(Composite *composite);
+extern void composite_build(Composite *composite);
+
+extern Vec(uint32_t) composite_query(const Composite* composite, Box area);
+extern void composite_query_into(const Composite* composite, Box area, Vec(uint32_t)* result);
+extern bool composite_query_visit(const Composite* composite, Box area, BoxVisitFunc func, void* user_data);
+extern void composite_find_pairs(const Composite* composite, Vec(BoxPair)* pairs);
+
+extern void composite_debug_draw(const Composite* composite, SDL_Renderer *renderer);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "box.h"
+#include "grid.h"
+#include "ds.h"
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+// Cells summed by one task of the parallel prefix sum.
+#define CSR_GRID_SCAN_BLOCK 1024
+
+// Grid stored in compressed sparse row form. Inserts are staged and 'build'
+// counts the entries of every cell, prefix sums the counts and scatters the
+// entries into one contiguous array, so memory is proportional to the
+// entries and any cell density fits.
+//
+// With a thread pool every thread counts its own slice of the staged entries
+// into a private row of counts, the rows are prefix summed in blocks of cells
+// into per slice write cursors and every thread scatters its slice without
+// locks. The result is the same as building on one thread.
+typedef struct CsrGrid CsrGrid;
+struct CsrGrid {
+    Box world_box;
+    Vec2 cell_count;
+
+    Vec(BoxEntry) staged;
+
+    // Entries of cell 'i' are 'entries[cell_start[i]..cell_start[i+1]]'.
+    uint32_t *cell_start;
+    uint32_t *cell_cursor;
+    BoxEntry *entries;
+    uint32_t entry_count;
+    uint32_t entry_capacity;
+
+    ThreadPool *thread_pool;
+    // One row of 'cell_count' counts per thread, turned into write cursors.
+    uint32_t *slice_counts;
+    // Entries in every block of 'CSR_GRID_SCAN_BLOCK' cells.
+    uint32_t *block_sums;
+};
+
+extern CsrGrid* csr_grid_new(const GridDesc* desc);
+extern void csr_grid_free(CsrGrid *grid);
+
+extern void csr_grid_insert(CsrGrid *grid, uint32_t id, Box box);
+extern void csr_grid_build(CsrGrid *grid);
+extern void csr_grid_clear(CsrGrid *grid);
+
+extern Vec(uint32_t) csr_grid_query(const CsrGrid* grid, Box area);
+extern void csr_grid_query_into(const CsrGrid* grid, Box area, Vec(uint32_t)* result);
+extern bool csr_grid_query_visit(const CsrGrid* grid, Box area, BoxVisitFunc func, void* user_data);
+extern void csr_grid_find_pairs(const CsrGrid* grid, Vec(BoxPair)* pairs);
+
+extern void csr_grid_debug_draw(const CsrGrid* grid, SDL_Renderer *renderer);
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "box.h"
+#include "ds.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <SDL2/SDL.h>
+
+// Defined in 'strategy_interface.h', which includes this header.
+typedef struct Strategy Strategy;
+
+typedef struct DoubleBufferDesc DoubleBufferDesc;
+struct DoubleBufferDesc {
+    // Has to be safe to build one instance while another one is queried, so
+    // it must not share a thread pool with the readers.
+    const Strategy* strategy;
+    const void* desc;
+};
+
+// Two instances of a strategy, one queried while the other is built on a
+// background thread. Inserts go to the next generation and 'build' hands it
+// to the builder and returns right away, queries keep seeing the last
+// finished generation until the builder swaps it in. Queries are one
+// generation behind unless 'double_buffer_sync' is called after 'build'.
+//
+// Readers never block: they count themselves in on the generation they
+// query and check it's still the current one, the builder waits for a
+// generation to have no readers left before clearing it.
+typedef struct DoubleBuffer DoubleBuffer;
+struct DoubleBuffer {
+    const Strategy* strategy;
+    void* generations[2];
+    // Generation queries go to, only written by the builder.
+    uint32_t front;
+    // Readers inside each generation.
+    uint32_t *readers;
+
+    // Boxes of the next generation.
+    Vec(BoxEntry) staged;
+    // Boxes handed to the builder, owned by it while 'pending' is set.
+    Vec(BoxEntry) building;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    bool pending;
+    bool quit;
+};
+
+extern DoubleBuffer* double_buffer_new(const DoubleBufferDesc* desc);
+extern void double_buffer_free(DoubleBuffer *buffer);
+
+extern void double_buffer_insert(DoubleBuffer *buffer, uint32_t id, Box box);
+// Only clears the next generation, the current one stays queryable.
+extern void double_buffer_clear(DoubleBuffer *buffer);
+// Waits for the previous build if it's still running, never for readers.
+extern void double_buffer_build(DoubleBuffer *buffer);
+// Waits until the last built generation is the one being queried.
+extern void double_buffer_sync(DoubleBuffer *buffer);
+
+extern Vec(uint32_t) double_buffer_query(const DoubleBuffer* buffer, Box area);
+extern void double_buffer_query_into(const DoubleBuffer* buffer, Box area, Vec(uint32_t)* result);
+extern bool double_buffer_query_visit(const DoubleBuffer* buffer, Box area, BoxVisitFunc func, void* user_data);
+extern void double_buffer_find_pairs(const DoubleBuffer* buffer, Vec(BoxPair)* pairs);
+
+extern void double_buffer_debug_draw(const DoubleBuffer* buffer, SDL_Renderer *renderer);
@@ -4,13 +4,17 @@
 #include <stdint.h>
 #include <SDL2/SDL.h>
 #include "ds.h"
+#include "thread_pool.h"
 
 #define GRID_MAX_BOX_COUNT 512
 
 typedef struct Cell Cell;
 struct Cell {
-    Box boxes[GRID_MAX_BOX_COUNT];
-    uint32_t box_i;
+    BoxEntry entries[GRID_MAX_BOX_COUNT];
+    // Entries past 'GRID_MAX_BOX_COUNT' spill in here, 'entry_i' counts both.
+    Vec(BoxEntry) overflow;
+    uint32_t entry_i;
+    bool dirty;
 };
 
 typedef struct Grid Grid;
@@ -18,20 +22,39 @@ struct Grid {
     Box world_box;
     Vec2 cell_count;
     Cell *cells;
+    // Current box of every id, used to find its cells again on update and
+    // remove.
+    Vec(Box) boxes;
+    // Whether an id is currently stored, unknown ids are ignored by update
+    // and remove.
+    Vec(bool) present;
+    // Cells written to since the last clear, so clearing doesn't have to
+    // walk the whole grid.
+    Vec(uint32_t) dirty_cells;
+    // Entries that had to spill out of a full cell since creation. Raise
+    // 'GRID_MAX_BOX_COUNT' or the cell count if this keeps growing.
+    size_t overflow_count;
 };
 
 typedef struct GridDesc GridDesc;
 struct GridDesc {
     Box grid_size;
     Vec2 cell_count;
+    // Optional, 'CsrGrid' builds on all threads of this pool when set.
+    ThreadPool *thread_pool;
 };
 
 extern Grid* grid_new(const GridDesc* desc);
 extern void grid_free(Grid *grid);
 
-extern void grid_insert(Grid *grid, Box box);
+extern void grid_insert(Grid *grid, uint32_t id, Box box);
+extern void grid_update(Grid *grid, uint32_t id, Box box);
+extern void grid_remove(Grid *grid, uint32_t id);
 extern void grid_clear(Grid *grid);
 
-extern Vec(Box) grid_query(const Grid* grid, Box area);
+extern Vec(uint32_t) grid_query(const Grid* grid, Box area);
+extern void grid_query_into(const Grid* grid, Box area, Vec(uint32_t)* result);
+extern bool grid_query_visit(const Grid* grid, Box area, BoxVisitFunc func, void* user_data);
+extern void grid_find_pairs(const Grid* grid, Vec(BoxPair)* pairs);
 
 extern void grid_debug_draw(const Grid* grid, SDL_Renderer *renderer);
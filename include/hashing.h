@@ -4,35 +4,101 @@
 #include "vec2.h"
 #include <stdint.h>
 #include "ds.h"
+#include "thread_pool.h"
 #include <SDL2/SDL.h>
 
 #define SPATIAL_HASH_MAX_BOX_COUNT 128
+#define SPATIAL_HASH_FILL_LIMIT 0.75
+// 'cell_key' of cell (INT32_MIN, INT32_MIN), which can't be stored. Zero so
+// freshly allocated buckets are empty.
+#define SPATIAL_HASH_EMPTY_KEY 0
 
+// A single cell of the hash map. Buckets are open addressed, so every bucket
+// only ever holds the entries of the cell it's keyed by.
 typedef struct Bucket Bucket;
 struct Bucket {
-    Box boxes[SPATIAL_HASH_MAX_BOX_COUNT];
-    uint32_t box_i;
+    // 'cell_key' of the cell, or 'SPATIAL_HASH_EMPTY_KEY'. Concurrent inserts
+    // claim a bucket by swapping its key in, so the cell is known the moment
+    // the bucket is taken.
+    uint64_t key;
+    BoxEntry entries[SPATIAL_HASH_MAX_BOX_COUNT];
+    // Entries past 'SPATIAL_HASH_MAX_BOX_COUNT' spill in here, 'entry_i'
+    // counts both.
+    Vec(BoxEntry) overflow;
+    uint32_t entry_i;
+};
+
+// Entry a concurrent insert found no room for, inserted by 'publish'.
+typedef struct SpatialHashPending SpatialHashPending;
+struct SpatialHashPending {
+    int32_t x, y;
+    BoxEntry entry;
 };
 
 typedef struct SpatialHash SpatialHash;
 struct SpatialHash {
     Vec2 cell_size;
+    // Always a power of two so buckets can be indexed with a mask. Grows once
+    // more than 'SPATIAL_HASH_FILL_LIMIT' of it is in use.
     uint32_t map_capacity;
     Bucket *buckets;
+    // Current box of every id, used to find its cells again on update and
+    // remove.
+    Vec(Box) boxes;
+    // Whether an id is currently stored, unknown ids are ignored by update
+    // and remove.
+    Vec(bool) present;
+    // Slots of every used bucket, so clearing and growing only touch those.
+    Vec(uint32_t) dirty_buckets;
+    // Entries that had to spill out of a full bucket since creation. Raise
+    // 'SPATIAL_HASH_MAX_BOX_COUNT' or shrink the cells if this keeps growing.
+    size_t overflow_count;
+
+    // Buckets in use, counted atomically by concurrent inserts to reserve
+    // their slot of 'dirty_buckets'.
+    uint32_t claimed_count;
+    // Entries for full buckets, or for new cells once the map would have to
+    // grow. One list per inserting thread, kept between builds.
+    Vec(SpatialHashPending) *pending;
+    uint32_t pending_count;
+
+    // With a thread pool inserts are staged and 'build' inserts them
+    // concurrently from all threads.
+    ThreadPool *thread_pool;
+    Vec(BoxEntry) staged;
 };
 
 typedef struct SpatialHashDesc SpatialHashDesc;
 struct SpatialHashDesc {
     uint32_t map_capacity;
     Vec2 cell_size;
+    // Optional, builds on all threads of this pool when set.
+    ThreadPool *thread_pool;
 };
 
 extern SpatialHash* spatial_hash_new(const SpatialHashDesc* desc);
 extern void spatial_hash_free(SpatialHash *space);
 
-extern void spatial_hash_insert(SpatialHash *space, Box box);
+extern void spatial_hash_insert(SpatialHash *space, uint32_t id, Box box);
+extern void spatial_hash_update(SpatialHash *space, uint32_t id, Box box);
+extern void spatial_hash_remove(SpatialHash *space, uint32_t id);
 extern void spatial_hash_clear(SpatialHash *space);
+extern void spatial_hash_build(SpatialHash *space);
+
+// Concurrent inserts. After 'begin_insert' up to 'thread_count' threads can
+// call 'insert_concurrent' with ids below 'id_count', each passing its own
+// 'thread' below 'thread_count'. Buckets are claimed with a compare and swap
+// of their key and entries take their slot with one too, entries that don't
+// fit go to the list of their thread. Once every insert has returned,
+// 'publish' adds those serially and from then on readers see all of them.
+// No other function may be called in between.
+extern void spatial_hash_begin_insert(SpatialHash *space, uint32_t id_count, uint32_t thread_count);
+extern void spatial_hash_insert_concurrent(SpatialHash *space, uint32_t thread, uint32_t id, Box box);
+extern void spatial_hash_publish(SpatialHash *space);
 
-extern Vec(Box) spatial_hash_query(const SpatialHash* space, Box area);
+extern Vec(uint32_t) spatial_hash_query(const SpatialHash* space, Box area);
+extern void spatial_hash_query_into(const SpatialHash* space, Box area, Vec(uint32_t)* result);
+extern bool spatial_hash_query_visit(const SpatialHash* space, Box area, BoxVisitFunc func, void* user_data);
+extern void spatial_hash_find_pairs(const SpatialHash* space, Vec(BoxPair)* pairs);
 
 extern void spatial_hash_debug_draw(const SpatialHash* space, SDL_Renderer *renderer);
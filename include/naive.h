@@ -7,12 +7,17 @@
 
 typedef struct Naive Naive;
 struct Naive {
-    Vec(Box) boxes;
+    Vec(BoxEntry) entries;
 };
 
 extern Naive* naive_new(const void* desc);
 extern void naive_free(Naive* data);
-extern void naive_insert(Naive* data, Box box);
+extern void naive_insert(Naive* data, uint32_t id, Box box);
+extern void naive_update(Naive* data, uint32_t id, Box box);
+extern void naive_remove(Naive* data, uint32_t id);
 extern void naive_clear(Naive* data);
-extern Vec(Box) naive_query(const Naive* data, Box area);
+extern Vec(uint32_t) naive_query(const Naive* data, Box area);
+extern void naive_query_into(const Naive* data, Box area, Vec(uint32_t)* result);
+extern bool naive_query_visit(const Naive* data, Box area, BoxVisitFunc func, void* user_data);
+extern void naive_find_pairs(const Naive* data, Vec(BoxPair)* pairs);
 extern void naive_debug_draw(const Naive* data, SDL_Renderer* renderer);
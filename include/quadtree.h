@@ -2,12 +2,17 @@
 
 #include "box.h"
 #include "ds.h"
+#include "thread_pool.h"
 
 #include <stdint.h>
 
 #include <SDL2/SDL.h>
 
 #define MAX_BOX_COUNT 128
+// Nodes allocated at once when the node pool runs out.
+#define QUADTREE_NODE_CHUNK_SIZE 64
+// Subtrees with fewer boxes than this aren't split into more tasks.
+#define QUADTREE_BUILD_TASK_MIN 256
 
 typedef struct QuadtreeNode QuadtreeNode;
 struct QuadtreeNode {
@@ -16,20 +21,68 @@ struct QuadtreeNode {
     QuadtreeNode *sw; // South west - Bottom left
     QuadtreeNode *se; // South east - Bottom right
 
-    Box boxes[MAX_BOX_COUNT];
-    size_t box_i;
+    BoxEntry entries[MAX_BOX_COUNT];
+    // Entries past 'MAX_BOX_COUNT' spill in here, 'entry_i' counts both.
+    Vec(BoxEntry) overflow;
+    size_t entry_i;
     bool devided;
 
     Box area;
 };
 
+// Subtree built by one task of a parallel build. Every task takes whole
+// chunks of nodes, so tasks never share a chunk and don't need to lock.
+typedef struct QuadtreeBuild QuadtreeBuild;
+struct QuadtreeBuild {
+    QuadtreeNode *node;
+    uint32_t depth;
+    // Entries reaching 'node', followed by the ones handed to the children
+    // further down.
+    Vec(BoxEntry) entries;
+    // Children every entry of the node being split goes to.
+    Vec(uint8_t) masks;
+
+    QuadtreeNode *chunk;
+    size_t chunk_i;
+    // Chunks allocated by this task, added to the pool afterwards.
+    Vec(QuadtreeNode*) new_chunks;
+    size_t overflow_count;
+};
+
 typedef struct Quadtree Quadtree;
 struct Quadtree {
-    QuadtreeNode *node_pool;
+    QuadtreeNode *root;
+    // Fixed size chunks of nodes, allocated as the tree grows so nodes never
+    // move. They're kept and reused after a clear.
+    Vec(QuadtreeNode*) node_chunks;
     size_t node_pool_i;
+    // Nodes released by collapsing siblings, reused before the pool grows.
+    Vec(QuadtreeNode*) free_nodes;
+    // Current box of every id, used to find its leaves again on update and
+    // remove.
+    Vec(Box) boxes;
+    // Whether an id is currently stored, unknown ids are ignored by update
+    // and remove.
+    Vec(bool) present;
 
     uint32_t max_depth;
     uint32_t max_box_count;
+    float looseness;
+
+    // Entries that had to spill out of a full node since creation. Raise
+    // 'max_depth' or 'MAX_BOX_COUNT' if this keeps growing.
+    size_t overflow_count;
+
+    // With a thread pool inserts are staged and 'build' builds the tree top
+    // down. The top levels are split on the calling thread until subtrees are
+    // small enough, then every subtree is built by a task.
+    ThreadPool *thread_pool;
+    Vec(BoxEntry) staged;
+    QuadtreeBuild top_build;
+    Vec(QuadtreeBuild) builds;
+    size_t build_count;
+    // Next chunk of 'node_chunks' handed to a task, taken atomically.
+    size_t build_chunk_i;
 };
 
 typedef struct QuadtreeDesc QuadtreeDesc;
@@ -37,14 +90,28 @@ struct QuadtreeDesc {
     Box area;
     int max_depth;
     int max_box_count;
+    // Fraction of a node's size its bounds are grown by on every side. When
+    // non-zero the tree is loose: every box is stored once, in the deepest
+    // node whose grown bounds contain it, instead of in every leaf it
+    // overlaps.
+    float looseness;
+    // Optional, builds on all threads of this pool when set. Ignored by the
+    // compact quadtree.
+    ThreadPool *thread_pool;
 };
 
 extern Quadtree* quadtree_new(const QuadtreeDesc* desc);
 extern void quadtree_free(Quadtree *quadtree);
 
-extern void quadtree_insert(Quadtree *quadtree, Box box);
+extern void quadtree_insert(Quadtree *quadtree, uint32_t id, Box box);
+extern void quadtree_update(Quadtree *quadtree, uint32_t id, Box box);
+extern void quadtree_remove(Quadtree *quadtree, uint32_t id);
 extern void quadtree_clear(Quadtree *quadtree);
+extern void quadtree_build(Quadtree *quadtree);
 
-extern Vec(Box) quadtree_query(const Quadtree* quadtree, Box area);
+extern Vec(uint32_t) quadtree_query(const Quadtree* quadtree, Box area);
+extern void quadtree_query_into(const Quadtree* quadtree, Box area, Vec(uint32_t)* result);
+extern bool quadtree_query_visit(const Quadtree* quadtree, Box area, BoxVisitFunc func, void* user_data);
+extern void quadtree_find_pairs(const Quadtree* quadtree, Vec(BoxPair)* pairs);
 
 extern void quadtree_debug_draw(const Quadtree* quadtree, SDL_Renderer *renderer);
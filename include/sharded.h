@@ -0,0 +1,94 @@
+#pragma once
+
+#include "box.h"
+#include "ds.h"
+#include "thread_pool.h"
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+// Bins per axis of the density histograms tile borders are picked from.
+#define SHARDED_DENSITY_BINS 256
+
+// Defined in 'strategy_interface.h', which includes this header.
+typedef struct Strategy Strategy;
+
+typedef struct ShardedDesc ShardedDesc;
+struct ShardedDesc {
+    // Instantiated once per tile.
+    const Strategy* strategy;
+    const void* desc;
+
+    // Region tile borders are balanced over, boxes outside it end up in the
+    // tiles along its edges.
+    Box area;
+    uint32_t column_count;
+    uint32_t row_count;
+
+    // Optional, builds and pairs the tiles on all threads of this pool. The
+    // tiles' strategy must not use the same pool.
+    ThreadPool *thread_pool;
+};
+
+typedef struct ShardedTile ShardedTile;
+struct ShardedTile {
+    void* data;
+    // Half open bounds, infinite along the border of the world.
+    Vec2 min;
+    Vec2 max;
+    // Boxes overlapping the tile, including the halo of boxes reaching in
+    // from neighbouring tiles.
+    Vec(BoxEntry) entries;
+};
+
+// World split into a grid of tiles, each with its own instance of a strategy
+// holding every box overlapping it. 'build' first picks the tile borders so
+// every column, and every row within a column, holds about as many box
+// centers as the others, then builds every tile on its own thread.
+//
+// A pair overlapping several tiles is found in all of them, only the tile
+// containing the top left corner of the overlap reports it. Queries go to
+// every tile the area overlaps and can return boxes more than once.
+typedef struct Sharded Sharded;
+struct Sharded {
+    const Strategy* strategy;
+    Box area;
+    uint32_t column_count;
+    uint32_t row_count;
+    ThreadPool *thread_pool;
+
+    // Column major, tile 'row' of column 'column' is
+    // 'tiles[column*row_count + row]'.
+    ShardedTile *tiles;
+    // Borders between the columns, 'column_count + 1' of them, and between
+    // the rows of every column, 'row_count + 1' per column.
+    float *column_x;
+    float *row_y;
+    // One density histogram per column.
+    uint32_t *histograms;
+
+    // Every box inserted since the last clear, the tiles are rebuilt from
+    // all of them since their borders move.
+    Vec(BoxEntry) entries;
+    // Current box of every id, for deciding which tile reports a pair.
+    Vec(Box) boxes;
+    // Copies of boxes beyond the first in the last build. Fewer tiles or
+    // smaller boxes keep this down.
+    size_t halo_count;
+};
+
+extern Sharded* sharded_new(const ShardedDesc* desc);
+extern void sharded_free(Sharded *sharded);
+
+extern void sharded_insert(Sharded *sharded, uint32_t id, Box box);
+extern void sharded_clear(Sharded *sharded);
+extern void sharded_build(Sharded *sharded);
+
+extern Vec(uint32_t) sharded_query(const Sharded* sharded, Box area);
+extern void sharded_query_into(const Sharded* sharded, Box area, Vec(uint32_t)* result);
+extern bool sharded_query_visit(const Sharded* sharded, Box area, BoxVisitFunc func, void* user_data);
+// Pairs every tile into buffers of its own call, so several threads can find
+// pairs at once. Their batches take turns on the pool.
+extern void sharded_find_pairs(const Sharded* sharded, Vec(BoxPair)* pairs);
+
+extern void sharded_debug_draw(const Sharded* sharded, SDL_Renderer *renderer);
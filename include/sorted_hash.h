@@ -0,0 +1,71 @@
+#pragma once
+
+#include "box.h"
+#include "vec2.h"
+#include "hashing.h"
+#include "ds.h"
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+// (cell key, entry) pair radix sorted by 'build'.
+typedef struct SortItem SortItem;
+struct SortItem {
+    uint64_t key;
+    uint32_t index;
+};
+
+// Run of entries belonging to one cell. A count of zero marks an empty slot.
+typedef struct SortedCell SortedCell;
+struct SortedCell {
+    uint64_t key;
+    uint32_t start;
+    uint32_t count;
+};
+
+// Spatial hash rebuilt from scratch every frame. Inserts are staged and
+// 'build' emits one (cell key, entry) pair per covered cell, radix sorts them
+// and indexes the runs of equal keys with a small open addressed table.
+// Memory is proportional to the live entries and no cell has a capacity.
+//
+// With a thread pool every thread emits the pairs of its slice of the staged
+// entries, and every radix pass histograms and scatters per slice, with the
+// prefix sum over (digit, slice) keeping the sort stable. Only indexing the
+// runs stays on one thread.
+typedef struct SortedSpatialHash SortedSpatialHash;
+struct SortedSpatialHash {
+    Vec2 cell_size;
+
+    Vec(BoxEntry) staged;
+
+    SortItem *items;
+    SortItem *items_back;
+    BoxEntry *entries;
+    uint32_t entry_count;
+    uint32_t entry_capacity;
+
+    // Power of two holding at least twice the runs of the last build. Starts
+    // at 'map_capacity', grows as needed and shrinks once four times too big.
+    SortedCell *cells;
+    uint32_t cell_capacity;
+
+    ThreadPool *thread_pool;
+    // 256 digit counts per thread, turned into write cursors.
+    uint32_t *slice_histograms;
+    // Where every slice's pairs start in 'items'.
+    uint32_t *slice_offsets;
+};
+
+extern SortedSpatialHash* sorted_hash_new(const SpatialHashDesc* desc);
+extern void sorted_hash_free(SortedSpatialHash *space);
+
+extern void sorted_hash_insert(SortedSpatialHash *space, uint32_t id, Box box);
+extern void sorted_hash_build(SortedSpatialHash *space);
+extern void sorted_hash_clear(SortedSpatialHash *space);
+
+extern Vec(uint32_t) sorted_hash_query(const SortedSpatialHash* space, Box area);
+extern void sorted_hash_query_into(const SortedSpatialHash* space, Box area, Vec(uint32_t)* result);
+extern bool sorted_hash_query_visit(const SortedSpatialHash* space, Box area, BoxVisitFunc func, void* user_data);
+extern void sorted_hash_find_pairs(const SortedSpatialHash* space, Vec(BoxPair)* pairs);
+
+extern void sorted_hash_debug_draw(const SortedSpatialHash* space, SDL_Renderer *renderer);
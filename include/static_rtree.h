@@ -0,0 +1,56 @@
+#pragma once
+
+#include "box.h"
+#include "ds.h"
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+// Children per node. The bounds of all children are stored component-wise,
+// so testing a node reads two cache lines of floats in order.
+#define STATIC_RTREE_FANOUT 8
+
+typedef struct StaticRTreeNode StaticRTreeNode;
+struct StaticRTreeNode {
+    float min_x[STATIC_RTREE_FANOUT];
+    float min_y[STATIC_RTREE_FANOUT];
+    float max_x[STATIC_RTREE_FANOUT];
+    float max_y[STATIC_RTREE_FANOUT];
+    // First child node, or first item for leaves. Children are consecutive.
+    uint32_t first_child;
+    uint32_t child_count;
+};
+
+// R-tree bulk loaded with Sort-Tile-Recursive packing for geometry that
+// doesn't move. Inserts are only staged, 'build' packs every level at once
+// and stores the nodes breadth first, root first and leaves last, in a
+// single array. Meant to be built once and queried many times.
+typedef struct StaticRTree StaticRTree;
+struct StaticRTree {
+    Vec(BoxEntry) staged;
+
+    // Staged entries in leaf order.
+    Vec(BoxEntry) items;
+    Vec(StaticRTreeNode) nodes;
+    // Index of the first leaf, every node from here on is a leaf.
+    uint32_t leaf_start;
+
+    // Reused while building.
+    Vec(BoxEntry) scratch;
+    Vec(StaticRTreeNode) level_scratch;
+    Vec(uint32_t) level_ends;
+};
+
+extern StaticRTree* static_rtree_new(const void* desc);
+extern void static_rtree_free(StaticRTree *tree);
+
+extern void static_rtree_insert(StaticRTree *tree, uint32_t id, Box box);
+extern void static_rtree_build(StaticRTree *tree);
+extern void static_rtree_clear(StaticRTree *tree);
+
+extern Vec(uint32_t) static_rtree_query(const StaticRTree* tree, Box area);
+extern void static_rtree_query_into(const StaticRTree* tree, Box area, Vec(uint32_t)* result);
+extern bool static_rtree_query_visit(const StaticRTree* tree, Box area, BoxVisitFunc func, void* user_data);
+extern void static_rtree_find_pairs(const StaticRTree* tree, Vec(BoxPair)* pairs);
+
+extern void static_rtree_debug_draw(const StaticRTree* tree, SDL_Renderer *renderer);
@@ -6,14 +6,41 @@
 #include "grid.h"
 #include "hashing.h"
 #include "naive.h"
+#include "csr_grid.h"
+#include "sorted_hash.h"
+#include "compact_quadtree.h"
+#include "sweep_and_prune.h"
+#include "aabb_tree.h"
+#include "static_rtree.h"
+#include "composite.h"
+#include "double_buffer.h"
+#include "sharded.h"
 
 #include <SDL2/SDL.h>
 
 typedef void* (*StrategyNewFunc)(const void* desc);
 typedef void (*StrategyFreeFunc)(void* data);
-typedef void (*StrategyInsertFunc)(void* data, Box box);
+typedef void (*StrategyInsertFunc)(void* data, uint32_t id, Box box);
+// Moves an already inserted id, doing as little work as possible when it
+// stays within the same cells.
+typedef void (*StrategyUpdateFunc)(void* data, uint32_t id, Box box);
+typedef void (*StrategyRemoveFunc)(void* data, uint32_t id);
 typedef void (*StrategyClearFunc)(void* data);
-typedef Vec(Box) (*StrategyQueryFunc)(const void* data, Box area);
+// Optional, called once after a batch of inserts and before querying by
+// strategies that build their index in bulk.
+typedef void (*StrategyBuildFunc)(void* data);
+// Optional, waits until queries see everything built so far. Only needed by
+// strategies that build in the background.
+typedef void (*StrategySyncFunc)(void* data);
+typedef Vec(uint32_t) (*StrategyQueryFunc)(const void* data, Box area);
+// Appends to 'result' without freeing it, letting the caller reuse the same
+// buffer across queries by resetting it with 'vec_clear'.
+typedef void (*StrategyQueryIntoFunc)(const void* data, Box area, Vec(uint32_t)* result);
+// Calls 'func' for every candidate until it returns true. Returns whether the
+// query was stopped early.
+typedef bool (*StrategyVisitFunc)(const void* data, Box area, BoxVisitFunc func, void* user_data);
+// Appends every overlapping pair exactly once.
+typedef void (*StrategyFindPairsFunc)(const void* data, Vec(BoxPair)* pairs);
 typedef void (*StrategyDebugDrawFunc)(const void* data, SDL_Renderer* renderer);
 
 typedef struct Strategy Strategy;
@@ -21,8 +48,15 @@ struct Strategy {
     StrategyNewFunc new;
     StrategyFreeFunc free;
     StrategyInsertFunc insert;
+    StrategyUpdateFunc update;
+    StrategyRemoveFunc remove;
     StrategyClearFunc clear;
+    StrategyBuildFunc build;
+    StrategySyncFunc sync;
     StrategyQueryFunc query;
+    StrategyQueryIntoFunc query_into;
+    StrategyVisitFunc visit;
+    StrategyFindPairsFunc find_pairs;
     StrategyDebugDrawFunc debug_draw;
 };
 
@@ -30,8 +64,14 @@ static const Strategy STRATEGY_QUADTREE = {
     .new        = (StrategyNewFunc)       quadtree_new,
     .free       = (StrategyFreeFunc)      quadtree_free,
     .insert     = (StrategyInsertFunc)    quadtree_insert,
+    .update     = (StrategyUpdateFunc)    quadtree_update,
+    .remove     = (StrategyRemoveFunc)    quadtree_remove,
     .clear      = (StrategyClearFunc)     quadtree_clear,
+    .build      = (StrategyBuildFunc)     quadtree_build,
     .query      = (StrategyQueryFunc)     quadtree_query,
+    .query_into = (StrategyQueryIntoFunc) quadtree_query_into,
+    .visit      = (StrategyVisitFunc)     quadtree_query_visit,
+    .find_pairs = (StrategyFindPairsFunc) quadtree_find_pairs,
     .debug_draw = (StrategyDebugDrawFunc) quadtree_debug_draw,
 };
 
@@ -39,8 +79,13 @@ static const Strategy STRATEGY_GRID = {
     .new        = (StrategyNewFunc)       grid_new,
     .free       = (StrategyFreeFunc)      grid_free,
     .insert     = (StrategyInsertFunc)    grid_insert,
+    .update     = (StrategyUpdateFunc)    grid_update,
+    .remove     = (StrategyRemoveFunc)    grid_remove,
     .clear      = (StrategyClearFunc)     grid_clear,
     .query      = (StrategyQueryFunc)     grid_query,
+    .query_into = (StrategyQueryIntoFunc) grid_query_into,
+    .visit      = (StrategyVisitFunc)     grid_query_visit,
+    .find_pairs = (StrategyFindPairsFunc) grid_find_pairs,
     .debug_draw = (StrategyDebugDrawFunc) grid_debug_draw,
 };
 
@@ -48,8 +93,14 @@ static const Strategy STRATEGY_SPATIAL_HASHING = {
     .new        = (StrategyNewFunc)       spatial_hash_new,
     .free       = (StrategyFreeFunc)      spatial_hash_free,
     .insert     = (StrategyInsertFunc)    spatial_hash_insert,
+    .update     = (StrategyUpdateFunc)    spatial_hash_update,
+    .remove     = (StrategyRemoveFunc)    spatial_hash_remove,
     .clear      = (StrategyClearFunc)     spatial_hash_clear,
+    .build      = (StrategyBuildFunc)     spatial_hash_build,
     .query      = (StrategyQueryFunc)     spatial_hash_query,
+    .query_into = (StrategyQueryIntoFunc) spatial_hash_query_into,
+    .visit      = (StrategyVisitFunc)     spatial_hash_query_visit,
+    .find_pairs = (StrategyFindPairsFunc) spatial_hash_find_pairs,
     .debug_draw = (StrategyDebugDrawFunc) spatial_hash_debug_draw,
 };
 
@@ -57,7 +108,139 @@ static const Strategy STRATEGY_NAIVE = {
     .new        = (StrategyNewFunc)       naive_new,
     .free       = (StrategyFreeFunc)      naive_free,
     .insert     = (StrategyInsertFunc)    naive_insert,
+    .update     = (StrategyUpdateFunc)    naive_update,
+    .remove     = (StrategyRemoveFunc)    naive_remove,
     .clear      = (StrategyClearFunc)     naive_clear,
     .query      = (StrategyQueryFunc)     naive_query,
+    .query_into = (StrategyQueryIntoFunc) naive_query_into,
+    .visit      = (StrategyVisitFunc)     naive_query_visit,
+    .find_pairs = (StrategyFindPairsFunc) naive_find_pairs,
     .debug_draw = (StrategyDebugDrawFunc) naive_debug_draw,
 };
+
+static const Strategy STRATEGY_CSR_GRID = {
+    .new        = (StrategyNewFunc)       csr_grid_new,
+    .free       = (StrategyFreeFunc)      csr_grid_free,
+    .insert     = (StrategyInsertFunc)    csr_grid_insert,
+    .clear      = (StrategyClearFunc)     csr_grid_clear,
+    .build      = (StrategyBuildFunc)     csr_grid_build,
+    .query      = (StrategyQueryFunc)     csr_grid_query,
+    .query_into = (StrategyQueryIntoFunc) csr_grid_query_into,
+    .visit      = (StrategyVisitFunc)     csr_grid_query_visit,
+    .find_pairs = (StrategyFindPairsFunc) csr_grid_find_pairs,
+    .debug_draw = (StrategyDebugDrawFunc) csr_grid_debug_draw,
+};
+
+static const Strategy STRATEGY_SORTED_SPATIAL_HASHING = {
+    .new        = (StrategyNewFunc)       sorted_hash_new,
+    .free       = (StrategyFreeFunc)      sorted_hash_free,
+    .insert     = (StrategyInsertFunc)    sorted_hash_insert,
+    .clear      = (StrategyClearFunc)     sorted_hash_clear,
+    .build      = (StrategyBuildFunc)     sorted_hash_build,
+    .query      = (StrategyQueryFunc)     sorted_hash_query,
+    .query_into = (StrategyQueryIntoFunc) sorted_hash_query_into,
+    .visit      = (StrategyVisitFunc)     sorted_hash_query_visit,
+    .find_pairs = (StrategyFindPairsFunc) sorted_hash_find_pairs,
+    .debug_draw = (StrategyDebugDrawFunc) sorted_hash_debug_draw,
+};
+
+static const Strategy STRATEGY_COMPACT_QUADTREE = {
+    .new        = (StrategyNewFunc)       compact_quadtree_new,
+    .free       = (StrategyFreeFunc)      compact_quadtree_free,
+    .insert     = (StrategyInsertFunc)    compact_quadtree_insert,
+    .clear      = (StrategyClearFunc)     compact_quadtree_clear,
+    .build      = (StrategyBuildFunc)     compact_quadtree_build,
+    .query      = (StrategyQueryFunc)     compact_quadtree_query,
+    .query_into = (StrategyQueryIntoFunc) compact_quadtree_query_into,
+    .visit      = (StrategyVisitFunc)     compact_quadtree_query_visit,
+    .find_pairs = (StrategyFindPairsFunc) compact_quadtree_find_pairs,
+    .debug_draw = (StrategyDebugDrawFunc) compact_quadtree_debug_draw,
+};
+
+static const Strategy STRATEGY_SWEEP_AND_PRUNE = {
+    .new        = (StrategyNewFunc)       sweep_and_prune_new,
+    .free       = (StrategyFreeFunc)      sweep_and_prune_free,
+    .insert     = (StrategyInsertFunc)    sweep_and_prune_insert,
+    .update     = (StrategyUpdateFunc)    sweep_and_prune_update,
+    .remove     = (StrategyRemoveFunc)    sweep_and_prune_remove,
+    .clear      = (StrategyClearFunc)     sweep_and_prune_clear,
+    .build      = (StrategyBuildFunc)     sweep_and_prune_build,
+    .query      = (StrategyQueryFunc)     sweep_and_prune_query,
+    .query_into = (StrategyQueryIntoFunc) sweep_and_prune_query_into,
+    .visit      = (StrategyVisitFunc)     sweep_and_prune_query_visit,
+    .find_pairs = (StrategyFindPairsFunc) sweep_and_prune_find_pairs,
+    .debug_draw = (StrategyDebugDrawFunc) sweep_and_prune_debug_draw,
+};
+
+static const Strategy STRATEGY_AABB_TREE = {
+    .new        = (StrategyNewFunc)       aabb_tree_new,
+    .free       = (StrategyFreeFunc)      aabb_tree_free,
+    .insert     = (StrategyInsertFunc)    aabb_tree_insert,
+    .update     = (StrategyUpdateFunc)    aabb_tree_update,
+    .remove     = (StrategyRemoveFunc)    aabb_tree_remove,
+    .clear      = (StrategyClearFunc)     aabb_tree_clear,
+    .query      = (StrategyQueryFunc)     aabb_tree_query,
+    .query_into = (StrategyQueryIntoFunc) aabb_tree_query_into,
+    .visit      = (StrategyVisitFunc)     aabb_tree_query_visit,
+    .find_pairs = (StrategyFindPairsFunc) aabb_tree_find_pairs,
+    .debug_draw = (StrategyDebugDrawFunc) aabb_tree_debug_draw,
+};
+
+static const Strategy STRATEGY_STATIC_RTREE = {
+    .new        = (StrategyNewFunc)       static_rtree_new,
+    .free       = (StrategyFreeFunc)      static_rtree_free,
+    .insert     = (StrategyInsertFunc)    static_rtree_insert,
+    .clear      = (StrategyClearFunc)     static_rtree_clear,
+    .build      = (StrategyBuildFunc)     static_rtree_build,
+    .query      = (StrategyQueryFunc)     static_rtree_query,
+    .query_into = (StrategyQueryIntoFunc) static_rtree_query_into,
+    .visit      = (StrategyVisitFunc)     static_rtree_query_visit,
+    .find_pairs = (StrategyFindPairsFunc) static_rtree_find_pairs,
+    .debug_draw = (StrategyDebugDrawFunc) static_rtree_debug_draw,
+};
+
+// Takes a 'CompositeDesc' naming two of the strategies above.
+static const Strategy STRATEGY_COMPOSITE = {
+    .new        = (StrategyNewFunc)       composite_new,
+    .free       = (StrategyFreeFunc)      composite_free,
+    .insert     = (StrategyInsertFunc)    composite_insert,
+    .update     = (StrategyUpdateFunc)    composite_update,
+    .remove     = (StrategyRemoveFunc)    composite_remove,
+    .clear      = (StrategyClearFunc)     composite_clear,
+    .build      = (StrategyBuildFunc)     composite_build,
+    .query      = (StrategyQueryFunc)     composite_query,
+    .query_into = (StrategyQueryIntoFunc) composite_query_into,
+    .visit      = (StrategyVisitFunc)     composite_query_visit,
+    .find_pairs = (StrategyFindPairsFunc) composite_find_pairs,
+    .debug_draw = (StrategyDebugDrawFunc) composite_debug_draw,
+};
+
+// Takes a 'DoubleBufferDesc' wrapping one of the strategies above. Queries
+// see the generation of the previous 'build' until 'sync' is called.
+static const Strategy STRATEGY_DOUBLE_BUFFER = {
+    .new        = (StrategyNewFunc)       double_buffer_new,
+    .free       = (StrategyFreeFunc)      double_buffer_free,
+    .insert     = (StrategyInsertFunc)    double_buffer_insert,
+    .clear      = (StrategyClearFunc)     double_buffer_clear,
+    .build      = (StrategyBuildFunc)     double_buffer_build,
+    .sync       = (StrategySyncFunc)      double_buffer_sync,
+    .query      = (StrategyQueryFunc)     double_buffer_query,
+    .query_into = (StrategyQueryIntoFunc) double_buffer_query_into,
+    .visit      = (StrategyVisitFunc)     double_buffer_query_visit,
+    .find_pairs = (StrategyFindPairsFunc) double_buffer_find_pairs,
+    .debug_draw = (StrategyDebugDrawFunc) double_buffer_debug_draw,
+};
+
+// Takes a 'ShardedDesc' naming one of the strategies above for its tiles.
+static const Strategy STRATEGY_SHARDED = {
+    .new        = (StrategyNewFunc)       sharded_new,
+    .free       = (StrategyFreeFunc)      sharded_free,
+    .insert     = (StrategyInsertFunc)    sharded_insert,
+    .clear      = (StrategyClearFunc)     sharded_clear,
+    .build      = (StrategyBuildFunc)     sharded_build,
+    .query      = (StrategyQueryFunc)     sharded_query,
+    .query_into = (StrategyQueryIntoFunc) sharded_query_into,
+    .visit      = (StrategyVisitFunc)     sharded_query_visit,
+    .find_pairs = (StrategyFindPairsFunc) sharded_find_pairs,
+    .debug_draw = (StrategyDebugDrawFunc) sharded_debug_draw,
+};
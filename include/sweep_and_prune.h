@@ -0,0 +1,52 @@
+#pragma once
+
+#include "box.h"
+#include "ds.h"
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+#define SWEEP_AND_PRUNE_NONE UINT32_MAX
+// Rows the sweep intervals are spread over by 'debug_draw'.
+#define SWEEP_AND_PRUNE_DRAW_ROWS 16
+
+// Boxes kept sorted by their minimum x. Nothing is thrown away on clear, an
+// id inserted again in the next frame overwrites its previous entry in
+// place, so 'build' only has to insertion sort an almost sorted array. Needs
+// neither world bounds nor a cell size. Changes only show up in queries after
+// the next 'build'.
+typedef struct SweepAndPrune SweepAndPrune;
+struct SweepAndPrune {
+    // Sorted by 'box.pos.x' after 'build'.
+    Vec(BoxEntry) entries;
+    // Index into 'entries' of every id, 'SWEEP_AND_PRUNE_NONE' if it has
+    // none.
+    Vec(uint32_t) slots;
+    // Frame every id was last inserted in. Entries not inserted since the
+    // last clear are dropped by the next 'build'.
+    Vec(uint32_t) frames;
+    uint32_t frame;
+    // Entries appended since the last build, past a few of those a full sort
+    // beats insertion sort.
+    uint32_t new_count;
+
+    // Widest box, bounds how far left of a query an overlapping box can
+    // start.
+    float max_width;
+};
+
+extern SweepAndPrune* sweep_and_prune_new(const void* desc);
+extern void sweep_and_prune_free(SweepAndPrune *sap);
+
+extern void sweep_and_prune_insert(SweepAndPrune *sap, uint32_t id, Box box);
+extern void sweep_and_prune_update(SweepAndPrune *sap, uint32_t id, Box box);
+extern void sweep_and_prune_remove(SweepAndPrune *sap, uint32_t id);
+extern void sweep_and_prune_clear(SweepAndPrune *sap);
+extern void sweep_and_prune_build(SweepAndPrune *sap);
+
+extern Vec(uint32_t) sweep_and_prune_query(const SweepAndPrune* sap, Box area);
+extern void sweep_and_prune_query_into(const SweepAndPrune* sap, Box area, Vec(uint32_t)* result);
+extern bool sweep_and_prune_query_visit(const SweepAndPrune* sap, Box area, BoxVisitFunc func, void* user_data);
+extern void sweep_and_prune_find_pairs(const SweepAndPrune* sap, Vec(BoxPair)* pairs);
+
+extern void sweep_and_prune_debug_draw(const SweepAndPrune* sap, SDL_Renderer *renderer);
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// Called once for every task, 'thread' is the index of the thread running it
+// and is below 'thread_count', for picking per thread buffers.
+typedef void (*ThreadPoolTaskFunc)(void* user_data, uint32_t task, uint32_t thread);
+
+typedef struct ThreadPool ThreadPool;
+
+typedef struct ThreadPoolWorker ThreadPoolWorker;
+struct ThreadPoolWorker {
+    ThreadPool *pool;
+    pthread_t thread;
+    uint32_t index;
+};
+
+// Fixed set of threads running one batch of tasks at a time. The calling
+// thread works on the batch too, as thread 0.
+struct ThreadPool {
+    ThreadPoolWorker *workers;
+    uint32_t thread_count;
+
+    // Held for a whole batch, so batches started from several threads run
+    // one after another.
+    pthread_mutex_t batch_mutex;
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    // Bumped for every batch, workers wait for it to change.
+    uint32_t generation;
+    // Workers still busy with the current batch.
+    uint32_t working;
+    bool quit;
+
+    ThreadPoolTaskFunc func;
+    void* user_data;
+    uint32_t task_count;
+    // Next task to hand out, taken atomically.
+    uint32_t next_task;
+};
+
+// A 'thread_count' of 0 uses one thread per online core.
+extern ThreadPool* thread_pool_new(uint32_t thread_count);
+extern void thread_pool_free(ThreadPool *pool);
+
+// Runs 'func' for every task in '[0, task_count)' and returns once all of
+// them are done. Tasks are handed out one at a time, in no particular order.
+// Safe to call from several threads, but not from within a task of the same
+// pool.
+extern void thread_pool_run(ThreadPool *pool, ThreadPoolTaskFunc func, void* user_data, uint32_t task_count);
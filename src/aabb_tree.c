@@ -0,0 +1,414 @@
+#include "aabb_tree.h"
+#include "ds.h"
+
+#include <stdlib.h>
+
+static float box_perimeter(Box box) {
+    return 2.0f*(box.size.x + box.size.y);
+}
+
+static Box box_fatten(Box box, float margin) {
+    return (Box) {
+        .pos = vec2_subs(box.pos, margin),
+        .size = vec2_adds(box.size, 2.0f*margin),
+    };
+}
+
+static bool aabb_tree_is_leaf(const AabbTree *tree, uint32_t node) {
+    return tree->nodes[node].left == AABB_TREE_NULL;
+}
+
+// May grow 'nodes', so no node pointers survive a call.
+static uint32_t aabb_tree_alloc_node(AabbTree *tree) {
+    uint32_t node = tree->free_list;
+    if (node != AABB_TREE_NULL) {
+        tree->free_list = tree->nodes[node].parent;
+    } else {
+        node = vec_len(tree->nodes);
+        vec_push(tree->nodes, (AabbTreeNode) {0});
+    }
+
+    tree->nodes[node] = (AabbTreeNode) {
+        .parent = AABB_TREE_NULL,
+        .left = AABB_TREE_NULL,
+        .right = AABB_TREE_NULL,
+    };
+    return node;
+}
+
+static void aabb_tree_free_node(AabbTree *tree, uint32_t node) {
+    tree->nodes[node].parent = tree->free_list;
+    tree->nodes[node].height = -1;
+    tree->free_list = node;
+}
+
+static void aabb_tree_replace_child(AabbTree *tree, uint32_t parent, uint32_t old_child, uint32_t new_child) {
+    if (parent == AABB_TREE_NULL) {
+        tree->root = new_child;
+    } else if (tree->nodes[parent].left == old_child) {
+        tree->nodes[parent].left = new_child;
+    } else {
+        tree->nodes[parent].right = new_child;
+    }
+}
+
+static int32_t max_height(int32_t a, int32_t b) {
+    return a > b ? a : b;
+}
+
+// Rotates the taller grandchild of 'a' up if its children's heights differ
+// by more than one. Returns the node now at the position of 'a'.
+static uint32_t aabb_tree_balance(AabbTree *tree, uint32_t a) {
+    AabbTreeNode *nodes = tree->nodes;
+    AabbTreeNode *node_a = &nodes[a];
+    if (aabb_tree_is_leaf(tree, a) || node_a->height < 2) {
+        return a;
+    }
+
+    uint32_t b = node_a->left;
+    uint32_t c = node_a->right;
+    AabbTreeNode *node_b = &nodes[b];
+    AabbTreeNode *node_c = &nodes[c];
+    int32_t balance = node_c->height - node_b->height;
+
+    // Rotate 'c' up.
+    if (balance > 1) {
+        uint32_t f = node_c->left;
+        uint32_t g = node_c->right;
+        AabbTreeNode *node_f = &nodes[f];
+        AabbTreeNode *node_g = &nodes[g];
+
+        node_c->left = a;
+        node_c->parent = node_a->parent;
+        node_a->parent = c;
+        aabb_tree_replace_child(tree, node_c->parent, a, c);
+
+        if (node_f->height > node_g->height) {
+            node_c->right = f;
+            node_a->right = g;
+            node_g->parent = a;
+            node_a->box = box_union(node_b->box, node_g->box);
+            node_c->box = box_union(node_a->box, node_f->box);
+            node_a->height = 1 + max_height(node_b->height, node_g->height);
+            node_c->height = 1 + max_height(node_a->height, node_f->height);
+        } else {
+            node_c->right = g;
+            node_a->right = f;
+            node_f->parent = a;
+            node_a->box = box_union(node_b->box, node_f->box);
+            node_c->box = box_union(node_a->box, node_g->box);
+            node_a->height = 1 + max_height(node_b->height, node_f->height);
+            node_c->height = 1 + max_height(node_a->height, node_g->height);
+        }
+        return c;
+    }
+
+    // Rotate 'b' up.
+    if (balance < -1) {
+        uint32_t d = node_b->left;
+        uint32_t e = node_b->right;
+        AabbTreeNode *node_d = &nodes[d];
+        AabbTreeNode *node_e = &nodes[e];
+
+        node_b->left = a;
+        node_b->parent = node_a->parent;
+        node_a->parent = b;
+        aabb_tree_replace_child(tree, node_b->parent, a, b);
+
+        if (node_d->height > node_e->height) {
+            node_b->right = d;
+            node_a->left = e;
+            node_e->parent = a;
+            node_a->box = box_union(node_c->box, node_e->box);
+            node_b->box = box_union(node_a->box, node_d->box);
+            node_a->height = 1 + max_height(node_c->height, node_e->height);
+            node_b->height = 1 + max_height(node_a->height, node_d->height);
+        } else {
+            node_b->right = e;
+            node_a->left = d;
+            node_d->parent = a;
+            node_a->box = box_union(node_c->box, node_d->box);
+            node_b->box = box_union(node_a->box, node_e->box);
+            node_a->height = 1 + max_height(node_c->height, node_d->height);
+            node_b->height = 1 + max_height(node_a->height, node_e->height);
+        }
+        return b;
+    }
+
+    return a;
+}
+
+// Walks up from 'node' rebalancing and refitting every ancestor.
+static void aabb_tree_refit(AabbTree *tree, uint32_t node) {
+    while (node != AABB_TREE_NULL) {
+        node = aabb_tree_balance(tree, node);
+
+        AabbTreeNode *n = &tree->nodes[node];
+        const AabbTreeNode *left = &tree->nodes[n->left];
+        const AabbTreeNode *right = &tree->nodes[n->right];
+        n->height = 1 + max_height(left->height, right->height);
+        n->box = box_union(left->box, right->box);
+
+        node = n->parent;
+    }
+}
+
+// Cost of making 'leaf_box' a sibling of 'node', not counting the ancestors.
+static float aabb_tree_descend_cost(const AabbTree *tree, uint32_t node, Box leaf_box) {
+    Box combined = box_union(tree->nodes[node].box, leaf_box);
+    if (aabb_tree_is_leaf(tree, node)) {
+        return box_perimeter(combined);
+    }
+    return box_perimeter(combined) - box_perimeter(tree->nodes[node].box);
+}
+
+static void aabb_tree_insert_leaf(AabbTree *tree, uint32_t leaf) {
+    if (tree->root == AABB_TREE_NULL) {
+        tree->root = leaf;
+        tree->nodes[leaf].parent = AABB_TREE_NULL;
+        return;
+    }
+
+    // Find the best sibling by the surface area heuristic, in 2D the
+    // perimeter. Every ancestor of the new leaf grows by the same union, so
+    // descending pays that growth on top of the child's own cost.
+    const Box leaf_box = tree->nodes[leaf].box;
+    uint32_t index = tree->root;
+    while (!aabb_tree_is_leaf(tree, index)) {
+        const AabbTreeNode *node = &tree->nodes[index];
+        float area = box_perimeter(node->box);
+        float combined_area = box_perimeter(box_union(node->box, leaf_box));
+
+        float cost = 2.0f*combined_area;
+        float inheritance_cost = 2.0f*(combined_area - area);
+        float cost_left = aabb_tree_descend_cost(tree, node->left, leaf_box) + inheritance_cost;
+        float cost_right = aabb_tree_descend_cost(tree, node->right, leaf_box) + inheritance_cost;
+
+        if (cost < cost_left && cost < cost_right) {
+            break;
+        }
+        index = cost_left < cost_right ? node->left : node->right;
+    }
+
+    const uint32_t sibling = index;
+    const uint32_t old_parent = tree->nodes[sibling].parent;
+    const uint32_t new_parent = aabb_tree_alloc_node(tree);
+    tree->nodes[new_parent] = (AabbTreeNode) {
+        .box = box_union(leaf_box, tree->nodes[sibling].box),
+        .parent = old_parent,
+        .left = sibling,
+        .right = leaf,
+        .height = tree->nodes[sibling].height + 1,
+    };
+    tree->nodes[sibling].parent = new_parent;
+    tree->nodes[leaf].parent = new_parent;
+    aabb_tree_replace_child(tree, old_parent, sibling, new_parent);
+
+    aabb_tree_refit(tree, new_parent);
+}
+
+static void aabb_tree_remove_leaf(AabbTree *tree, uint32_t leaf) {
+    if (leaf == tree->root) {
+        tree->root = AABB_TREE_NULL;
+        return;
+    }
+
+    // The sibling takes the place of the parent.
+    const uint32_t parent = tree->nodes[leaf].parent;
+    const uint32_t grand_parent = tree->nodes[parent].parent;
+    const uint32_t sibling = tree->nodes[parent].left == leaf ? tree->nodes[parent].right : tree->nodes[parent].left;
+
+    aabb_tree_replace_child(tree, grand_parent, parent, sibling);
+    tree->nodes[sibling].parent = grand_parent;
+    aabb_tree_free_node(tree, parent);
+
+    aabb_tree_refit(tree, grand_parent);
+}
+
+AabbTree* aabb_tree_new(const AabbTreeDesc* desc) {
+    AabbTree* tree = malloc(sizeof(AabbTree));
+    *tree = (AabbTree) {
+        .root = AABB_TREE_NULL,
+        .free_list = AABB_TREE_NULL,
+        .margin = desc->margin,
+    };
+    return tree;
+}
+
+void aabb_tree_free(AabbTree *tree) {
+    vec_free(tree->nodes);
+    vec_free(tree->leaves);
+    vec_free(tree->boxes);
+    free(tree);
+}
+
+static uint32_t aabb_tree_leaf(const AabbTree *tree, uint32_t id) {
+    return id < vec_len(tree->leaves) ? tree->leaves[id] : AABB_TREE_NULL;
+}
+
+void aabb_tree_insert(AabbTree *tree, uint32_t id, Box box) {
+    // Inserting an id twice moves its leaf instead of adding another one.
+    if (aabb_tree_leaf(tree, id) != AABB_TREE_NULL) {
+        aabb_tree_update(tree, id, box);
+        return;
+    }
+
+    while (id >= vec_len(tree->leaves)) {
+        vec_push(tree->leaves, AABB_TREE_NULL);
+        vec_push(tree->boxes, (Box) {0});
+    }
+    tree->boxes[id] = box;
+
+    uint32_t leaf = aabb_tree_alloc_node(tree);
+    tree->nodes[leaf].box = box_fatten(box, tree->margin);
+    tree->nodes[leaf].id = id;
+    tree->leaves[id] = leaf;
+    aabb_tree_insert_leaf(tree, leaf);
+}
+
+void aabb_tree_remove(AabbTree *tree, uint32_t id) {
+    uint32_t leaf = aabb_tree_leaf(tree, id);
+    if (leaf == AABB_TREE_NULL) {
+        return;
+    }
+
+    aabb_tree_remove_leaf(tree, leaf);
+    aabb_tree_free_node(tree, leaf);
+    tree->leaves[id] = AABB_TREE_NULL;
+}
+
+void aabb_tree_update(AabbTree *tree, uint32_t id, Box box) {
+    uint32_t leaf = aabb_tree_leaf(tree, id);
+    if (leaf == AABB_TREE_NULL) {
+        return;
+    }
+    tree->boxes[id] = box;
+
+    // Still inside the fattened box, the tree doesn't change.
+    if (box_contains(tree->nodes[leaf].box, box)) {
+        return;
+    }
+
+    aabb_tree_remove_leaf(tree, leaf);
+    tree->nodes[leaf].box = box_fatten(box, tree->margin);
+    aabb_tree_insert_leaf(tree, leaf);
+}
+
+void aabb_tree_clear(AabbTree *tree) {
+    vec_clear(tree->nodes);
+    vec_clear(tree->leaves);
+    vec_clear(tree->boxes);
+    tree->root = AABB_TREE_NULL;
+    tree->free_list = AABB_TREE_NULL;
+}
+
+static void aabb_tree_query_helper(const AabbTree *tree, uint32_t node, Box area, Vec(uint32_t)* result) {
+    const AabbTreeNode *n = &tree->nodes[node];
+    if (!box_overlapp(n->box, area)) {
+        return;
+    }
+
+    if (n->left == AABB_TREE_NULL) {
+        vec_push(*result, n->id);
+        return;
+    }
+
+    aabb_tree_query_helper(tree, n->left, area, result);
+    aabb_tree_query_helper(tree, n->right, area, result);
+}
+
+void aabb_tree_query_into(const AabbTree* tree, Box area, Vec(uint32_t)* result) {
+    if (tree->root != AABB_TREE_NULL) {
+        aabb_tree_query_helper(tree, tree->root, area, result);
+    }
+}
+
+Vec(uint32_t) aabb_tree_query(const AabbTree* tree, Box area) {
+    Vec(uint32_t) result = NULL;
+    aabb_tree_query_into(tree, area, &result);
+    return result;
+}
+
+static bool aabb_tree_query_visit_helper(const AabbTree *tree, uint32_t node, Box area, BoxVisitFunc func, void* user_data) {
+    const AabbTreeNode *n = &tree->nodes[node];
+    if (!box_overlapp(n->box, area)) {
+        return false;
+    }
+
+    if (n->left == AABB_TREE_NULL) {
+        return func(user_data, n->id, tree->boxes[n->id]);
+    }
+
+    return aabb_tree_query_visit_helper(tree, n->left, area, func, user_data) ||
+        aabb_tree_query_visit_helper(tree, n->right, area, func, user_data);
+}
+
+bool aabb_tree_query_visit(const AabbTree* tree, Box area, BoxVisitFunc func, void* user_data) {
+    if (tree->root == AABB_TREE_NULL) {
+        return false;
+    }
+    return aabb_tree_query_visit_helper(tree, tree->root, area, func, user_data);
+}
+
+// Every pair with one leaf below 'a' and the other below 'b'.
+static void aabb_tree_pair_nodes(const AabbTree* tree, uint32_t a, uint32_t b, Vec(BoxPair)* pairs) {
+    const AabbTreeNode *node_a = &tree->nodes[a];
+    const AabbTreeNode *node_b = &tree->nodes[b];
+    if (!box_overlapp(node_a->box, node_b->box)) {
+        return;
+    }
+
+    bool leaf_a = node_a->left == AABB_TREE_NULL;
+    bool leaf_b = node_b->left == AABB_TREE_NULL;
+    if (leaf_a && leaf_b) {
+        if (box_overlapp(tree->boxes[node_a->id], tree->boxes[node_b->id])) {
+            vec_push(*pairs, box_pair(node_a->id, node_b->id));
+        }
+        return;
+    }
+
+    // Descend into the bigger node.
+    if (leaf_b || (!leaf_a && box_perimeter(node_a->box) > box_perimeter(node_b->box))) {
+        aabb_tree_pair_nodes(tree, node_a->left, b, pairs);
+        aabb_tree_pair_nodes(tree, node_a->right, b, pairs);
+    } else {
+        aabb_tree_pair_nodes(tree, a, node_b->left, pairs);
+        aabb_tree_pair_nodes(tree, a, node_b->right, pairs);
+    }
+}
+
+// Two leaves have exactly one lowest common ancestor, which is the only node
+// pairing its two subtrees against each other.
+static void aabb_tree_find_pairs_helper(const AabbTree* tree, uint32_t node, Vec(BoxPair)* pairs) {
+    const AabbTreeNode *n = &tree->nodes[node];
+    if (n->left == AABB_TREE_NULL) {
+        return;
+    }
+
+    aabb_tree_find_pairs_helper(tree, n->left, pairs);
+    aabb_tree_find_pairs_helper(tree, n->right, pairs);
+    aabb_tree_pair_nodes(tree, n->left, n->right, pairs);
+}
+
+void aabb_tree_find_pairs(const AabbTree* tree, Vec(BoxPair)* pairs) {
+    if (tree->root != AABB_TREE_NULL) {
+        aabb_tree_find_pairs_helper(tree, tree->root, pairs);
+    }
+}
+
+void aabb_tree_debug_draw(const AabbTree* tree, SDL_Renderer *renderer) {
+    for (size_t i = 0; i < vec_len(tree->nodes); i++) {
+        const AabbTreeNode *node = &tree->nodes[i];
+        if (node->height < 0) {
+            continue;
+        }
+
+        SDL_Rect rect = {
+            .x = node->box.pos.x,
+            .y = node->box.pos.y,
+            .w = node->box.size.x,
+            .h = node->box.size.y,
+        };
+        SDL_RenderDrawRect(renderer, &rect);
+    }
+}
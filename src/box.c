@@ -24,3 +24,37 @@ bool box_overlapp(Box a, Box b) {
            a.pos.y+a.size.y > b.pos.y &&
            a.pos.y < b.pos.y+b.size.y;
 }
+
+bool box_contains_point(Box box, Vec2 point) {
+    return point.x >= box.pos.x &&
+           point.x < box.pos.x+box.size.x &&
+           point.y >= box.pos.y &&
+           point.y < box.pos.y+box.size.y;
+}
+
+bool box_contains(Box outer, Box inner) {
+    return inner.pos.x >= outer.pos.x &&
+           inner.pos.y >= outer.pos.y &&
+           inner.pos.x+inner.size.x <= outer.pos.x+outer.size.x &&
+           inner.pos.y+inner.size.y <= outer.pos.y+outer.size.y;
+}
+
+Vec2 box_overlapp_min(Box a, Box b) {
+    return vec2(fmaxf(a.pos.x, b.pos.x), fmaxf(a.pos.y, b.pos.y));
+}
+
+Box box_union(Box a, Box b) {
+    Vec2 min = vec2(fminf(a.pos.x, b.pos.x), fminf(a.pos.y, b.pos.y));
+    Vec2 max = vec2(fmaxf(a.pos.x+a.size.x, b.pos.x+b.size.x), fmaxf(a.pos.y+a.size.y, b.pos.y+b.size.y));
+    return (Box) {
+        .pos = min,
+        .size = vec2_sub(max, min),
+    };
+}
+
+BoxPair box_pair(uint32_t a, uint32_t b) {
+    if (a < b) {
+        return (BoxPair) { .a = a, .b = b };
+    }
+    return (BoxPair) { .a = b, .b = a };
+}
@@ -0,0 +1,175 @@
+#include "collision_driver.h"
+#include "ds.h"
+
+#include <stdlib.h>
+
+typedef struct CollisionTask CollisionTask;
+struct CollisionTask {
+    CollisionDriver *driver;
+    const Strategy *strat;
+    const void *data;
+    const Box *boxes;
+    uint32_t count;
+    // Candidate count of every area, queries only.
+    uint32_t *starts;
+};
+
+static int id_cmp(const void *a, const void *b) {
+    uint32_t id_a = *(const uint32_t *) a;
+    uint32_t id_b = *(const uint32_t *) b;
+    return (id_a > id_b) - (id_a < id_b);
+}
+
+// Most queries only return a handful of candidates.
+static void sort_ids(uint32_t *ids, size_t count) {
+    if (count > 32) {
+        qsort(ids, count, sizeof(uint32_t), id_cmp);
+        return;
+    }
+    for (size_t i = 1; i < count; i++) {
+        uint32_t id = ids[i];
+        size_t j = i;
+        while (j > 0 && ids[j-1] > id) {
+            ids[j] = ids[j-1];
+            j--;
+        }
+        ids[j] = id;
+    }
+}
+
+static uint32_t chunk_count(uint32_t count) {
+    return (count + COLLISION_DRIVER_CHUNK_SIZE - 1) / COLLISION_DRIVER_CHUNK_SIZE;
+}
+
+static void collision_driver_reserve(CollisionDriver *driver, uint32_t chunks) {
+    if (chunks <= driver->chunk_capacity) {
+        return;
+    }
+
+    uint32_t capacity = chunks*2;
+    driver->chunk_pairs = realloc(driver->chunk_pairs, capacity * sizeof(*driver->chunk_pairs));
+    driver->chunk_ids = realloc(driver->chunk_ids, capacity * sizeof(*driver->chunk_ids));
+    for (uint32_t i = driver->chunk_capacity; i < capacity; i++) {
+        driver->chunk_pairs[i] = NULL;
+        driver->chunk_ids[i] = NULL;
+    }
+    driver->chunk_capacity = capacity;
+}
+
+CollisionDriver* collision_driver_new(ThreadPool *pool) {
+    CollisionDriver* driver = malloc(sizeof(CollisionDriver));
+    *driver = (CollisionDriver) {
+        .pool = pool,
+        .candidates = calloc(pool->thread_count, sizeof(Vec(uint32_t))),
+    };
+    return driver;
+}
+
+void collision_driver_free(CollisionDriver *driver) {
+    for (uint32_t i = 0; i < driver->pool->thread_count; i++) {
+        vec_free(driver->candidates[i]);
+    }
+    for (uint32_t i = 0; i < driver->chunk_capacity; i++) {
+        vec_free(driver->chunk_pairs[i]);
+        vec_free(driver->chunk_ids[i]);
+    }
+    free(driver->candidates);
+    free(driver->chunk_pairs);
+    free(driver->chunk_ids);
+    free(driver);
+}
+
+static void collision_driver_query_task(void* user_data, uint32_t chunk, uint32_t thread) {
+    (void) thread;
+    const CollisionTask *task = user_data;
+    Vec(uint32_t)* ids = &task->driver->chunk_ids[chunk];
+
+    vec_clear(*ids);
+    const uint32_t begin = chunk*COLLISION_DRIVER_CHUNK_SIZE;
+    const uint32_t end = begin + COLLISION_DRIVER_CHUNK_SIZE < task->count ? begin + COLLISION_DRIVER_CHUNK_SIZE : task->count;
+    for (uint32_t i = begin; i < end; i++) {
+        size_t len = vec_len(*ids);
+        task->strat->query_into(task->data, task->boxes[i], ids);
+        task->starts[i+1] = vec_len(*ids) - len;
+    }
+}
+
+void collision_driver_query(CollisionDriver *driver, const Strategy* strat, const void* data, const Box* areas, uint32_t count, Vec(uint32_t)* starts, Vec(uint32_t)* ids) {
+    const uint32_t chunks = chunk_count(count);
+    collision_driver_reserve(driver, chunks);
+
+    vec_clear(*starts);
+    vec_insert_arr(*starts, 0, NULL, count + 1);
+    (*starts)[0] = 0;
+
+    CollisionTask task = {
+        .driver = driver,
+        .strat = strat,
+        .data = data,
+        .boxes = areas,
+        .count = count,
+        .starts = *starts,
+    };
+    thread_pool_run(driver->pool, collision_driver_query_task, &task, chunks);
+
+    for (uint32_t i = 0; i < count; i++) {
+        (*starts)[i+1] += (*starts)[i];
+    }
+
+    vec_clear(*ids);
+    for (uint32_t chunk = 0; chunk < chunks; chunk++) {
+        if (vec_len(driver->chunk_ids[chunk]) > 0) {
+            vec_insert_arr(*ids, vec_len(*ids), driver->chunk_ids[chunk], vec_len(driver->chunk_ids[chunk]));
+        }
+    }
+}
+
+// Every box only pairs with the boxes after it, the candidates are sorted
+// first since strategies storing a box in several cells can return it more
+// than once.
+static void collision_driver_pairs_task(void* user_data, uint32_t chunk, uint32_t thread) {
+    const CollisionTask *task = user_data;
+    Vec(uint32_t)* candidates = &task->driver->candidates[thread];
+    Vec(BoxPair)* pairs = &task->driver->chunk_pairs[chunk];
+
+    vec_clear(*pairs);
+    const uint32_t begin = chunk*COLLISION_DRIVER_CHUNK_SIZE;
+    const uint32_t end = begin + COLLISION_DRIVER_CHUNK_SIZE < task->count ? begin + COLLISION_DRIVER_CHUNK_SIZE : task->count;
+    for (uint32_t i = begin; i < end; i++) {
+        const Box box = task->boxes[i];
+
+        vec_clear(*candidates);
+        task->strat->query_into(task->data, box, candidates);
+        sort_ids(*candidates, vec_len(*candidates));
+
+        for (size_t k = 0; k < vec_len(*candidates); k++) {
+            uint32_t j = (*candidates)[k];
+            if (j <= i || j >= task->count || (k > 0 && (*candidates)[k-1] == j)) {
+                continue;
+            }
+            if (box_overlapp(box, task->boxes[j])) {
+                vec_push(*pairs, box_pair(i, j));
+            }
+        }
+    }
+}
+
+void collision_driver_find_pairs(CollisionDriver *driver, const Strategy* strat, const void* data, const Box* boxes, uint32_t count, Vec(BoxPair)* pairs) {
+    const uint32_t chunks = chunk_count(count);
+    collision_driver_reserve(driver, chunks);
+
+    CollisionTask task = {
+        .driver = driver,
+        .strat = strat,
+        .data = data,
+        .boxes = boxes,
+        .count = count,
+    };
+    thread_pool_run(driver->pool, collision_driver_pairs_task, &task, chunks);
+
+    for (uint32_t chunk = 0; chunk < chunks; chunk++) {
+        if (vec_len(driver->chunk_pairs[chunk]) > 0) {
+            vec_insert_arr(*pairs, vec_len(*pairs), driver->chunk_pairs[chunk], vec_len(driver->chunk_pairs[chunk]));
+        }
+    }
+}
@@ -0,0 +1,384 @@
+#include "compact_quadtree.h"
+#include "box.h"
+#include "ds.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Each popped node pushes at most four children, so the stack never holds
+// more than three nodes per level on top of the one being expanded.
+#define STACK_SIZE (COMPACT_QUADTREE_MAX_DEPTH*3 + 1)
+
+typedef struct StackItem StackItem;
+struct StackItem {
+    uint32_t node;
+    Box area;
+};
+
+// Children are ordered north west, north east, south west, south east.
+static Box quadrant(Box area, uint32_t index) {
+    Vec2 half = vec2_divs(area.size, 2.0f);
+    return (Box) {
+        .pos = {
+            .x = area.pos.x + (index & 1)*half.x,
+            .y = area.pos.y + (index >> 1)*half.y,
+        },
+        .size = half,
+    };
+}
+
+// Child fully containing 'box', or 4 if it has to stay in this node.
+static uint32_t quadrant_of(Box area, Box box) {
+    Vec2 center = vec2_add(area.pos, vec2_divs(area.size, 2.0f));
+    uint32_t index = (box.pos.x >= center.x) + (box.pos.y >= center.y)*2;
+    if (!box_contains(quadrant(area, index), box)) {
+        return 4;
+    }
+    return index;
+}
+
+// Levels of the Morton path, the last level never splits.
+static uint32_t path_levels(const CompactQuadtree *quadtree) {
+    return quadtree->max_depth > 1 ? quadtree->max_depth - 1 : 0;
+}
+
+// Descends with the same float quadrants the queries use, so an item always
+// lies inside the bounds derived for its node.
+static uint64_t morton_key(const CompactQuadtree *quadtree, Box box) {
+    const uint32_t levels = path_levels(quadtree);
+    Box area = quadtree->area;
+    uint64_t path = 0;
+    uint32_t depth = 0;
+    if (box_contains(area, box)) {
+        while (depth < levels) {
+            uint32_t index = quadrant_of(area, box);
+            if (index == 4) {
+                break;
+            }
+            path = (path << 2) | index;
+            area = quadrant(area, index);
+            depth++;
+        }
+    }
+
+    path <<= 2*(levels - depth);
+    return (path << 8) | depth;
+}
+
+// Child digit of 'key' below a node at 'depth'.
+static uint32_t morton_digit(const CompactQuadtree *quadtree, uint64_t key, uint32_t depth) {
+    return (key >> (8 + 2*(path_levels(quadtree) - 1 - depth))) & 3;
+}
+
+// LSD radix sort on 8 bit digits, ping-ponging between 'keys' and
+// 'keys_back'. Digits shared by every key are skipped.
+static void compact_quadtree_radix_sort(CompactQuadtree *quadtree, uint32_t count) {
+    const uint32_t key_bits = 8 + 2*path_levels(quadtree);
+    for (uint32_t shift = 0; shift < key_bits; shift += 8) {
+        uint32_t histogram[256] = {0};
+        for (uint32_t i = 0; i < count; i++) {
+            histogram[(quadtree->keys[i].key >> shift) & 0xff]++;
+        }
+        if (histogram[(quadtree->keys[0].key >> shift) & 0xff] == count) {
+            continue;
+        }
+
+        uint32_t offset = 0;
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t digit_count = histogram[i];
+            histogram[i] = offset;
+            offset += digit_count;
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            MortonItem item = quadtree->keys[i];
+            quadtree->keys_back[histogram[(item.key >> shift) & 0xff]++] = item;
+        }
+
+        Vec(MortonItem) temp = quadtree->keys;
+        quadtree->keys = quadtree->keys_back;
+        quadtree->keys_back = temp;
+    }
+}
+
+// First index in [begin, end) whose child digit is at least 'digit'. The
+// digits of a node's range are sorted.
+static uint32_t lower_bound_digit(const CompactQuadtree *quadtree, uint32_t begin, uint32_t end, uint32_t depth, uint32_t digit) {
+    while (begin < end) {
+        uint32_t mid = begin + (end - begin)/2;
+        if (morton_digit(quadtree, quadtree->keys[mid].key, depth) < digit) {
+            begin = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+    return begin;
+}
+
+// Items are already in pre-order, so building a node only has to find where
+// its own items end and where each child's range starts.
+static void compact_quadtree_build_node(CompactQuadtree *quadtree, uint32_t node_i, uint32_t begin, uint32_t end, uint32_t depth) {
+    CompactQuadtreeNode node = {
+        .item_start = begin,
+        .item_count = end - begin,
+        .item_end = end,
+    };
+
+    if (end - begin <= quadtree->max_box_count || depth >= path_levels(quadtree)) {
+        quadtree->nodes[node_i] = node;
+        return;
+    }
+
+    // Items staying here sort before the ones below them.
+    uint32_t stay_end = begin;
+    while (stay_end < end && (quadtree->keys[stay_end].key & 0xff) == depth) {
+        stay_end++;
+    }
+
+    // Nothing would move down, splitting only adds empty children.
+    if (stay_end == end) {
+        quadtree->nodes[node_i] = node;
+        return;
+    }
+
+    uint32_t child_begin[5];
+    child_begin[0] = stay_end;
+    for (uint32_t i = 1; i < 4; i++) {
+        child_begin[i] = lower_bound_digit(quadtree, child_begin[i-1], end, depth, i);
+    }
+    child_begin[4] = end;
+
+    node.item_count = stay_end - begin;
+    node.first_child = vec_len(quadtree->nodes);
+    quadtree->nodes[node_i] = node;
+    vec_insert_arr(quadtree->nodes, vec_len(quadtree->nodes), NULL, 4);
+
+    for (uint32_t i = 0; i < 4; i++) {
+        compact_quadtree_build_node(quadtree, node.first_child + i, child_begin[i], child_begin[i+1], depth+1);
+    }
+}
+
+CompactQuadtree* compact_quadtree_new(const QuadtreeDesc* desc) {
+    CompactQuadtree* quadtree = malloc(sizeof(CompactQuadtree));
+    *quadtree = (CompactQuadtree) {
+        .area = desc->area,
+        .max_depth = desc->max_depth < COMPACT_QUADTREE_MAX_DEPTH ? desc->max_depth : COMPACT_QUADTREE_MAX_DEPTH,
+        .max_box_count = desc->max_box_count,
+    };
+    return quadtree;
+}
+
+void compact_quadtree_free(CompactQuadtree *quadtree) {
+    vec_free(quadtree->nodes);
+    vec_free(quadtree->items);
+    vec_free(quadtree->item_ids);
+    vec_free(quadtree->scratch);
+    vec_free(quadtree->keys);
+    vec_free(quadtree->keys_back);
+    free(quadtree);
+}
+
+void compact_quadtree_insert(CompactQuadtree *quadtree, uint32_t id, Box box) {
+    BoxEntry entry = {
+        .box = box,
+        .id = id,
+    };
+    vec_push(quadtree->items, entry);
+}
+
+void compact_quadtree_build(CompactQuadtree *quadtree) {
+    uint32_t count = vec_len(quadtree->items);
+    vec_clear(quadtree->keys);
+    vec_clear(quadtree->keys_back);
+    vec_clear(quadtree->scratch);
+    vec_clear(quadtree->item_ids);
+    vec_clear(quadtree->nodes);
+
+    for (uint32_t i = 0; i < count; i++) {
+        MortonItem item = {
+            .key = morton_key(quadtree, quadtree->items[i].box),
+            .index = i,
+        };
+        vec_push(quadtree->keys, item);
+    }
+    vec_insert_arr(quadtree->keys_back, 0, NULL, count);
+
+    if (count > 0) {
+        compact_quadtree_radix_sort(quadtree, count);
+    }
+
+    // Gather the items in key order.
+    for (uint32_t i = 0; i < count; i++) {
+        BoxEntry entry = quadtree->items[quadtree->keys[i].index];
+        vec_push(quadtree->scratch, entry);
+        vec_push(quadtree->item_ids, entry.id);
+    }
+    Vec(BoxEntry) temp = quadtree->items;
+    quadtree->items = quadtree->scratch;
+    quadtree->scratch = temp;
+
+    vec_insert_arr(quadtree->nodes, 0, NULL, 1);
+    compact_quadtree_build_node(quadtree, 0, 0, count, 0);
+}
+
+void compact_quadtree_clear(CompactQuadtree *quadtree) {
+    vec_clear(quadtree->items);
+    vec_clear(quadtree->nodes);
+}
+
+void compact_quadtree_query_into(const CompactQuadtree* quadtree, Box area, Vec(uint32_t)* result) {
+    if (vec_len(quadtree->nodes) == 0) {
+        return;
+    }
+
+    // The root is always visited since it also holds boxes reaching outside
+    // of the tree's area.
+    StackItem stack[STACK_SIZE];
+    uint32_t stack_i = 0;
+    stack[stack_i++] = (StackItem) { .node = 0, .area = quadtree->area };
+
+    while (stack_i > 0) {
+        StackItem item = stack[--stack_i];
+        const CompactQuadtreeNode *node = &quadtree->nodes[item.node];
+
+        // Everything below a node inside the query is a candidate, and the
+        // subtree's items are contiguous.
+        if (node->first_child == 0 || box_contains(area, item.area)) {
+            uint32_t end = node->first_child == 0 ? node->item_start + node->item_count : node->item_end;
+            vec_insert_arr(*result, vec_len(*result), &quadtree->item_ids[node->item_start], end - node->item_start);
+            continue;
+        }
+
+        vec_insert_arr(*result, vec_len(*result), &quadtree->item_ids[node->item_start], node->item_count);
+        for (uint32_t i = 0; i < 4; i++) {
+            Box child_area = quadrant(item.area, i);
+            if (box_overlapp(child_area, area)) {
+                stack[stack_i++] = (StackItem) { .node = node->first_child + i, .area = child_area };
+            }
+        }
+    }
+}
+
+bool compact_quadtree_query_visit(const CompactQuadtree* quadtree, Box area, BoxVisitFunc func, void* user_data) {
+    if (vec_len(quadtree->nodes) == 0) {
+        return false;
+    }
+
+    StackItem stack[STACK_SIZE];
+    uint32_t stack_i = 0;
+    stack[stack_i++] = (StackItem) { .node = 0, .area = quadtree->area };
+
+    while (stack_i > 0) {
+        StackItem item = stack[--stack_i];
+        const CompactQuadtreeNode *node = &quadtree->nodes[item.node];
+
+        bool whole_subtree = node->first_child == 0 || box_contains(area, item.area);
+        uint32_t end = whole_subtree ? node->item_end : node->item_start + node->item_count;
+        for (uint32_t i = node->item_start; i < end; i++) {
+            if (func(user_data, quadtree->items[i].id, quadtree->items[i].box)) {
+                return true;
+            }
+        }
+        if (whole_subtree) {
+            continue;
+        }
+
+        for (uint32_t i = 0; i < 4; i++) {
+            Box child_area = quadrant(item.area, i);
+            if (box_overlapp(child_area, area)) {
+                stack[stack_i++] = (StackItem) { .node = node->first_child + i, .area = child_area };
+            }
+        }
+    }
+
+    return false;
+}
+
+Vec(uint32_t) compact_quadtree_query(const CompactQuadtree* quadtree, Box area) {
+    Vec(uint32_t) result = NULL;
+    compact_quadtree_query_into(quadtree, area, &result);
+    return result;
+}
+
+// Pair 'entry' with everything overlapping it in the subtree of 'node_i'.
+static void compact_quadtree_pair_subtree(const CompactQuadtree* quadtree, uint32_t node_i, Box node_area, const BoxEntry *entry, Vec(BoxPair)* pairs) {
+    const CompactQuadtreeNode *node = &quadtree->nodes[node_i];
+    for (uint32_t i = node->item_start; i < node->item_start + node->item_count; i++) {
+        if (box_overlapp(entry->box, quadtree->items[i].box)) {
+            vec_push(*pairs, box_pair(entry->id, quadtree->items[i].id));
+        }
+    }
+
+    if (node->first_child == 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < 4; i++) {
+        Box child_area = quadrant(node_area, i);
+        if (box_overlapp(child_area, entry->box)) {
+            compact_quadtree_pair_subtree(quadtree, node->first_child + i, child_area, entry, pairs);
+        }
+    }
+}
+
+// Every box is stored once, so a pair is either two items of the same node
+// or an item paired with something below it.
+static void compact_quadtree_find_pairs_helper(const CompactQuadtree* quadtree, uint32_t node_i, Box node_area, Vec(BoxPair)* pairs) {
+    const CompactQuadtreeNode *node = &quadtree->nodes[node_i];
+    const uint32_t items_end = node->item_start + node->item_count;
+    for (uint32_t i = node->item_start; i < items_end; i++) {
+        const BoxEntry *a = &quadtree->items[i];
+        for (uint32_t j = i+1; j < items_end; j++) {
+            if (box_overlapp(a->box, quadtree->items[j].box)) {
+                vec_push(*pairs, box_pair(a->id, quadtree->items[j].id));
+            }
+        }
+
+        if (node->first_child == 0) {
+            continue;
+        }
+        for (uint32_t c = 0; c < 4; c++) {
+            Box child_area = quadrant(node_area, c);
+            if (box_overlapp(child_area, a->box)) {
+                compact_quadtree_pair_subtree(quadtree, node->first_child + c, child_area, a, pairs);
+            }
+        }
+    }
+
+    if (node->first_child == 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < 4; i++) {
+        compact_quadtree_find_pairs_helper(quadtree, node->first_child + i, quadrant(node_area, i), pairs);
+    }
+}
+
+void compact_quadtree_find_pairs(const CompactQuadtree* quadtree, Vec(BoxPair)* pairs) {
+    if (vec_len(quadtree->nodes) > 0) {
+        compact_quadtree_find_pairs_helper(quadtree, 0, quadtree->area, pairs);
+    }
+}
+
+static void compact_quadtree_debug_draw_helper(const CompactQuadtree* quadtree, uint32_t node_i, Box node_area, SDL_Renderer *renderer) {
+    const CompactQuadtreeNode *node = &quadtree->nodes[node_i];
+    if (node->first_child != 0) {
+        for (uint32_t i = 0; i < 4; i++) {
+            compact_quadtree_debug_draw_helper(quadtree, node->first_child + i, quadrant(node_area, i), renderer);
+        }
+    }
+
+    SDL_Rect rect = {
+        .x = node_area.pos.x,
+        .y = node_area.pos.y,
+        .w = node_area.size.x,
+        .h = node_area.size.y,
+    };
+    SDL_RenderDrawRect(renderer, &rect);
+}
+
+void compact_quadtree_debug_draw(const CompactQuadtree* quadtree, SDL_Renderer *renderer) {
+    if (vec_len(quadtree->nodes) > 0) {
+        compact_quadtree_debug_draw_helper(quadtree, 0, quadtree->area, renderer);
+    }
+}
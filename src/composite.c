@@ -0,0 +1,252 @@
+#include "composite.h"
+#include "strategy_interface.h"
+#include "ds.h"
+
+#include <stdlib.h>
+
+#define COMPOSITE_NO_SLOT UINT32_MAX
+
+static int pair_cmp(const void *a, const void *b) {
+    const BoxPair *pair_a = a;
+    const BoxPair *pair_b = b;
+    if (pair_a->a != pair_b->a) {
+        return (pair_a->a > pair_b->a) - (pair_a->a < pair_b->a);
+    }
+    return (pair_a->b > pair_b->b) - (pair_a->b < pair_b->b);
+}
+
+Composite* composite_new(const CompositeDesc* desc) {
+    Composite* composite = malloc(sizeof(Composite));
+    *composite = (Composite) {
+        .static_strategy = desc->static_strategy,
+        .static_data = desc->static_strategy->new(desc->static_desc),
+        .dynamic_strategy = desc->dynamic_strategy,
+        .dynamic_data = desc->dynamic_strategy->new(desc->dynamic_desc),
+        .is_static = desc->is_static,
+        .user_data = desc->user_data,
+    };
+    return composite;
+}
+
+void composite_free(Composite *composite) {
+    composite->static_strategy->free(composite->static_data);
+    composite->dynamic_strategy->free(composite->dynamic_data);
+    vec_free(composite->layers);
+    vec_free(composite->boxes);
+    vec_free(composite->dynamic_ids);
+    vec_free(composite->dynamic_slots);
+    vec_free(composite->static_pairs);
+    free(composite);
+}
+
+static CompositeLayer composite_layer(const Composite *composite, uint32_t id) {
+    return id < vec_len(composite->layers) ? composite->layers[id] : COMPOSITE_NONE;
+}
+
+void composite_insert(Composite *composite, uint32_t id, Box box) {
+    CompositeLayer layer = COMPOSITE_DYNAMIC;
+    if (composite->is_static != NULL && composite->is_static(composite->user_data, id, box)) {
+        layer = COMPOSITE_STATIC;
+    }
+    composite_insert_layer(composite, id, box, layer);
+}
+
+void composite_insert_layer(Composite *composite, uint32_t id, Box box, CompositeLayer layer) {
+    while (id >= vec_len(composite->layers)) {
+        vec_push(composite->layers, COMPOSITE_NONE);
+        vec_push(composite->boxes, (Box) { 0 });
+        vec_push(composite->dynamic_slots, COMPOSITE_NO_SLOT);
+    }
+
+    const CompositeLayer old_layer = composite->layers[id];
+    if (old_layer == COMPOSITE_DYNAMIC && layer == COMPOSITE_DYNAMIC) {
+        composite_update(composite, id, box);
+        return;
+    }
+    // Moving to the other layer, it can't stay in both. Stays where it is if
+    // the old layer can't remove boxes.
+    if (old_layer != COMPOSITE_NONE && old_layer != layer) {
+        composite_remove(composite, id);
+        if (composite->layers[id] != COMPOSITE_NONE) {
+            return;
+        }
+    }
+
+    if (layer == COMPOSITE_STATIC) {
+        // Static boxes don't move, so inserting one again changes nothing.
+        if (old_layer == COMPOSITE_STATIC) {
+            return;
+        }
+        composite->static_strategy->insert(composite->static_data, id, box);
+        composite->static_dirty = true;
+    } else {
+        composite->dynamic_strategy->insert(composite->dynamic_data, id, box);
+        composite->dynamic_slots[id] = vec_len(composite->dynamic_ids);
+        vec_push(composite->dynamic_ids, id);
+    }
+
+    composite->layers[id] = layer;
+    composite->boxes[id] = box;
+}
+
+void composite_update(Composite *composite, uint32_t id, Box box) {
+    const CompositeLayer layer = composite_layer(composite, id);
+    if (layer == COMPOSITE_NONE) {
+        return;
+    }
+
+    // Left where it is if its layer can't move boxes.
+    if (layer == COMPOSITE_STATIC) {
+        if (composite->static_strategy->update == NULL) {
+            return;
+        }
+        composite->static_strategy->update(composite->static_data, id, box);
+        composite->static_dirty = true;
+    } else {
+        if (composite->dynamic_strategy->update == NULL) {
+            return;
+        }
+        composite->dynamic_strategy->update(composite->dynamic_data, id, box);
+    }
+    composite->boxes[id] = box;
+}
+
+void composite_remove(Composite *composite, uint32_t id) {
+    const CompositeLayer layer = composite_layer(composite, id);
+    if (layer == COMPOSITE_NONE) {
+        return;
+    }
+
+    // Left where it is if its layer can't remove boxes.
+    if (layer == COMPOSITE_STATIC) {
+        if (composite->static_strategy->remove == NULL) {
+            return;
+        }
+        composite->static_strategy->remove(composite->static_data, id);
+        composite->static_dirty = true;
+    } else {
+        if (composite->dynamic_strategy->remove == NULL) {
+            return;
+        }
+        composite->dynamic_strategy->remove(composite->dynamic_data, id);
+
+        uint32_t slot = composite->dynamic_slots[id];
+        uint32_t last = vec_last(composite->dynamic_ids);
+        composite->dynamic_ids[slot] = last;
+        composite->dynamic_slots[last] = slot;
+        vec_pop(composite->dynamic_ids);
+        composite->dynamic_slots[id] = COMPOSITE_NO_SLOT;
+    }
+    composite->layers[id] = COMPOSITE_NONE;
+}
+
+void composite_clear(Composite *composite) {
+    composite->dynamic_strategy->clear(composite->dynamic_data);
+    for (size_t i = 0; i < vec_len(composite->dynamic_ids); i++) {
+        uint32_t id = composite->dynamic_ids[i];
+        composite->layers[id] = COMPOSITE_NONE;
+        composite->dynamic_slots[id] = COMPOSITE_NO_SLOT;
+    }
+    vec_clear(composite->dynamic_ids);
+}
+
+void composite_clear_static(Composite *composite) {
+    composite->static_strategy->clear(composite->static_data);
+    for (size_t id = 0; id < vec_len(composite->layers); id++) {
+        if (composite->layers[id] == COMPOSITE_STATIC) {
+            composite->layers[id] = COMPOSITE_NONE;
+        }
+    }
+    composite->static_dirty = true;
+}
+
+void composite_build(Composite *composite) {
+    if (composite->static_dirty) {
+        if (composite->static_strategy->build != NULL) {
+            composite->static_strategy->build(composite->static_data);
+        }
+        vec_clear(composite->static_pairs);
+        composite->static_strategy->find_pairs(composite->static_data, &composite->static_pairs);
+        composite->static_dirty = false;
+    }
+
+    if (composite->dynamic_strategy->build != NULL) {
+        composite->dynamic_strategy->build(composite->dynamic_data);
+    }
+}
+
+void composite_query_into(const Composite* composite, Box area, Vec(uint32_t)* result) {
+    composite->static_strategy->query_into(composite->static_data, area, result);
+    composite->dynamic_strategy->query_into(composite->dynamic_data, area, result);
+}
+
+bool composite_query_visit(const Composite* composite, Box area, BoxVisitFunc func, void* user_data) {
+    return composite->static_strategy->visit(composite->static_data, area, func, user_data) ||
+           composite->dynamic_strategy->visit(composite->dynamic_data, area, func, user_data);
+}
+
+Vec(uint32_t) composite_query(const Composite* composite, Box area) {
+    Vec(uint32_t) result = NULL;
+    composite_query_into(composite, area, &result);
+    return result;
+}
+
+// Dynamic box visiting the static layer for pairs.
+typedef struct CompositeVisit CompositeVisit;
+struct CompositeVisit {
+    const Composite* composite;
+    uint32_t id;
+    Box box;
+    Vec(BoxPair)* pairs;
+};
+
+static bool composite_pair_static(void* user_data, uint32_t other, Box other_box) {
+    (void) other_box;
+    CompositeVisit *visit = user_data;
+    const Composite *composite = visit->composite;
+    if (composite->layers[other] == COMPOSITE_STATIC && box_overlapp(visit->box, composite->boxes[other])) {
+        vec_push(*visit->pairs, box_pair(visit->id, other));
+    }
+    return false;
+}
+
+// Pairs within each layer come from the layers themselves, the ones across
+// them from visiting the static layer with every dynamic box. Its candidates
+// can repeat, so the pairs across layers are sorted afterwards to drop the
+// duplicates.
+void composite_find_pairs(const Composite* composite, Vec(BoxPair)* pairs) {
+    if (vec_len(composite->static_pairs) > 0) {
+        vec_insert_arr(*pairs, vec_len(*pairs), composite->static_pairs, vec_len(composite->static_pairs));
+    }
+    composite->dynamic_strategy->find_pairs(composite->dynamic_data, pairs);
+
+    const size_t first = vec_len(*pairs);
+    for (size_t i = 0; i < vec_len(composite->dynamic_ids); i++) {
+        CompositeVisit visit = {
+            .composite = composite,
+            .id = composite->dynamic_ids[i],
+            .box = composite->boxes[composite->dynamic_ids[i]],
+            .pairs = pairs,
+        };
+        composite->static_strategy->visit(composite->static_data, visit.box, composite_pair_static, &visit);
+    }
+
+    const size_t count = vec_len(*pairs) - first;
+    if (count < 2) {
+        return;
+    }
+    BoxPair *across = *pairs + first;
+    qsort(across, count, sizeof(BoxPair), pair_cmp);
+    size_t kept = 1;
+    for (size_t i = 1; i < count; i++) {
+        if (pair_cmp(&across[i], &across[kept-1]) != 0) {
+            across[kept++] = across[i];
+        }
+    }
+    vec_remove_arr(*pairs, first + kept, count - kept, NULL);
+}
+
+void composite_debug_draw(const Composite* composite, SDL_Renderer *renderer) {
+    composite->static_strategy->debug_draw(composite->static_data, renderer);
+    composite->dynamic_strategy->debug_draw(composite->dynamic_data, renderer);
+}
@@ -0,0 +1,311 @@
+#include "csr_grid.h"
+#include "cell_range.h"
+#include "ds.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static int32_t clampi(int32_t value, int32_t min, int32_t max) {
+    if (value < min) {
+        return min;
+    }
+    if (value > max) {
+        return max;
+    }
+    return value;
+}
+
+// Anything outside the world is clamped into the border cells so it's never
+// lost.
+static CellRange csr_grid_cell_range(const CsrGrid* grid, Box box) {
+    CellRange range = cell_range(box, grid->world_box.pos, vec2_div(grid->world_box.size, grid->cell_count));
+    return (CellRange) {
+        .min_x = clampi(range.min_x, 0, grid->cell_count.x-1),
+        .min_y = clampi(range.min_y, 0, grid->cell_count.y-1),
+        .max_x = clampi(range.max_x, 1, grid->cell_count.x),
+        .max_y = clampi(range.max_y, 1, grid->cell_count.y),
+    };
+}
+
+CsrGrid* csr_grid_new(const GridDesc* desc) {
+    uint32_t cell_count = desc->cell_count.x*desc->cell_count.y;
+    CsrGrid* grid = malloc(sizeof(CsrGrid));
+    *grid = (CsrGrid) {
+        .world_box = desc->grid_size,
+        .cell_count = desc->cell_count,
+        .cell_start = calloc(cell_count + 1, sizeof(uint32_t)),
+        .cell_cursor = calloc(cell_count, sizeof(uint32_t)),
+        .thread_pool = desc->thread_pool,
+    };
+    if (grid->thread_pool != NULL) {
+        grid->slice_counts = malloc(grid->thread_pool->thread_count * cell_count * sizeof(uint32_t));
+        grid->block_sums = malloc((cell_count + CSR_GRID_SCAN_BLOCK - 1) / CSR_GRID_SCAN_BLOCK * sizeof(uint32_t));
+    }
+    return grid;
+}
+
+void csr_grid_free(CsrGrid *grid) {
+    vec_free(grid->staged);
+    free(grid->cell_start);
+    free(grid->cell_cursor);
+    free(grid->entries);
+    free(grid->slice_counts);
+    free(grid->block_sums);
+    free(grid);
+}
+
+void csr_grid_insert(CsrGrid *grid, uint32_t id, Box box) {
+    BoxEntry entry = {
+        .box = box,
+        .id = id,
+    };
+    vec_push(grid->staged, entry);
+}
+
+static void csr_grid_reserve(CsrGrid *grid, uint32_t count) {
+    if (count > grid->entry_capacity) {
+        grid->entry_capacity = count*2;
+        free(grid->entries);
+        grid->entries = malloc(grid->entry_capacity * sizeof(BoxEntry));
+    }
+}
+
+// Staged entries '[begin, end)' counted and scattered by one thread.
+static void csr_grid_slice(const CsrGrid* grid, uint32_t slice, uint32_t* begin, uint32_t* end) {
+    const uint32_t count = vec_len(grid->staged);
+    const uint32_t slice_count = grid->thread_pool->thread_count;
+    *begin = (uint64_t) count * slice / slice_count;
+    *end = (uint64_t) count * (slice + 1) / slice_count;
+}
+
+static void csr_grid_count_task(void* user_data, uint32_t slice, uint32_t thread) {
+    (void) thread;
+    CsrGrid *grid = user_data;
+    const uint32_t width = grid->cell_count.x;
+    const uint32_t cell_count = grid->cell_count.x*grid->cell_count.y;
+    uint32_t *counts = grid->slice_counts + (size_t) slice*cell_count;
+
+    memset(counts, 0, cell_count * sizeof(uint32_t));
+    uint32_t begin, end;
+    csr_grid_slice(grid, slice, &begin, &end);
+    for (uint32_t i = begin; i < end; i++) {
+        CellRange range = csr_grid_cell_range(grid, grid->staged[i].box);
+        for (int32_t y = range.min_y; y < range.max_y; y++) {
+            for (int32_t x = range.min_x; x < range.max_x; x++) {
+                counts[x+y*width]++;
+            }
+        }
+    }
+}
+
+static void csr_grid_sum_task(void* user_data, uint32_t block, uint32_t thread) {
+    (void) thread;
+    CsrGrid *grid = user_data;
+    const uint32_t cell_count = grid->cell_count.x*grid->cell_count.y;
+    const uint32_t slice_count = grid->thread_pool->thread_count;
+    const uint32_t begin = block*CSR_GRID_SCAN_BLOCK;
+    const uint32_t end = begin + CSR_GRID_SCAN_BLOCK < cell_count ? begin + CSR_GRID_SCAN_BLOCK : cell_count;
+
+    uint32_t sum = 0;
+    for (uint32_t slice = 0; slice < slice_count; slice++) {
+        const uint32_t *counts = grid->slice_counts + (size_t) slice*cell_count;
+        for (uint32_t cell = begin; cell < end; cell++) {
+            sum += counts[cell];
+        }
+    }
+    grid->block_sums[block] = sum;
+}
+
+// Within a cell the slices are laid out in order, which keeps the entries in
+// the order of the single threaded build.
+static void csr_grid_offset_task(void* user_data, uint32_t block, uint32_t thread) {
+    (void) thread;
+    CsrGrid *grid = user_data;
+    const uint32_t cell_count = grid->cell_count.x*grid->cell_count.y;
+    const uint32_t slice_count = grid->thread_pool->thread_count;
+    const uint32_t begin = block*CSR_GRID_SCAN_BLOCK;
+    const uint32_t end = begin + CSR_GRID_SCAN_BLOCK < cell_count ? begin + CSR_GRID_SCAN_BLOCK : cell_count;
+
+    uint32_t offset = grid->block_sums[block];
+    for (uint32_t cell = begin; cell < end; cell++) {
+        grid->cell_start[cell] = offset;
+        for (uint32_t slice = 0; slice < slice_count; slice++) {
+            uint32_t *counts = grid->slice_counts + (size_t) slice*cell_count;
+            uint32_t count = counts[cell];
+            counts[cell] = offset;
+            offset += count;
+        }
+    }
+}
+
+static void csr_grid_scatter_task(void* user_data, uint32_t slice, uint32_t thread) {
+    (void) thread;
+    CsrGrid *grid = user_data;
+    const uint32_t width = grid->cell_count.x;
+    const uint32_t cell_count = grid->cell_count.x*grid->cell_count.y;
+    uint32_t *cursors = grid->slice_counts + (size_t) slice*cell_count;
+
+    uint32_t begin, end;
+    csr_grid_slice(grid, slice, &begin, &end);
+    for (uint32_t i = begin; i < end; i++) {
+        CellRange range = csr_grid_cell_range(grid, grid->staged[i].box);
+        for (int32_t y = range.min_y; y < range.max_y; y++) {
+            for (int32_t x = range.min_x; x < range.max_x; x++) {
+                grid->entries[cursors[x+y*width]++] = grid->staged[i];
+            }
+        }
+    }
+}
+
+static void csr_grid_build_parallel(CsrGrid *grid) {
+    ThreadPool *pool = grid->thread_pool;
+    const uint32_t cell_count = grid->cell_count.x*grid->cell_count.y;
+    const uint32_t block_count = (cell_count + CSR_GRID_SCAN_BLOCK - 1) / CSR_GRID_SCAN_BLOCK;
+
+    thread_pool_run(pool, csr_grid_count_task, grid, pool->thread_count);
+    thread_pool_run(pool, csr_grid_sum_task, grid, block_count);
+
+    uint32_t offset = 0;
+    for (uint32_t block = 0; block < block_count; block++) {
+        uint32_t sum = grid->block_sums[block];
+        grid->block_sums[block] = offset;
+        offset += sum;
+    }
+    grid->cell_start[cell_count] = offset;
+    grid->entry_count = offset;
+    csr_grid_reserve(grid, offset);
+
+    thread_pool_run(pool, csr_grid_offset_task, grid, block_count);
+    thread_pool_run(pool, csr_grid_scatter_task, grid, pool->thread_count);
+}
+
+void csr_grid_build(CsrGrid *grid) {
+    if (grid->thread_pool != NULL) {
+        csr_grid_build_parallel(grid);
+        return;
+    }
+
+    const uint32_t width = grid->cell_count.x;
+    const uint32_t cell_count = grid->cell_count.x*grid->cell_count.y;
+
+    // Count the entries of every cell, shifted by one so the exclusive prefix
+    // sum lands in place.
+    memset(grid->cell_start, 0, (cell_count + 1) * sizeof(uint32_t));
+    for (size_t i = 0; i < vec_len(grid->staged); i++) {
+        CellRange range = csr_grid_cell_range(grid, grid->staged[i].box);
+        for (int32_t y = range.min_y; y < range.max_y; y++) {
+            for (int32_t x = range.min_x; x < range.max_x; x++) {
+                grid->cell_start[x+y*width + 1]++;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < cell_count; i++) {
+        grid->cell_start[i+1] += grid->cell_start[i];
+    }
+
+    grid->entry_count = grid->cell_start[cell_count];
+    csr_grid_reserve(grid, grid->entry_count);
+
+    // Scatter into the ranges reserved for each cell.
+    memcpy(grid->cell_cursor, grid->cell_start, cell_count * sizeof(uint32_t));
+    for (size_t i = 0; i < vec_len(grid->staged); i++) {
+        CellRange range = csr_grid_cell_range(grid, grid->staged[i].box);
+        for (int32_t y = range.min_y; y < range.max_y; y++) {
+            for (int32_t x = range.min_x; x < range.max_x; x++) {
+                grid->entries[grid->cell_cursor[x+y*width]++] = grid->staged[i];
+            }
+        }
+    }
+}
+
+void csr_grid_clear(CsrGrid *grid) {
+    const uint32_t cell_count = grid->cell_count.x*grid->cell_count.y;
+    vec_clear(grid->staged);
+    // Every cell empty until the next build, the entries are left allocated.
+    memset(grid->cell_start, 0, (cell_count + 1) * sizeof(uint32_t));
+    grid->entry_count = 0;
+}
+
+void csr_grid_query_into(const CsrGrid* grid, Box area, Vec(uint32_t)* result) {
+    const uint32_t width = grid->cell_count.x;
+    CellRange range = csr_grid_cell_range(grid, area);
+    for (int32_t y = range.min_y; y < range.max_y; y++) {
+        // Cells of a row are adjacent, so the whole row is one range.
+        uint32_t begin = grid->cell_start[range.min_x+y*width];
+        uint32_t end = grid->cell_start[range.max_x+y*width];
+        for (uint32_t i = begin; i < end; i++) {
+            vec_push(*result, grid->entries[i].id);
+        }
+    }
+}
+
+bool csr_grid_query_visit(const CsrGrid* grid, Box area, BoxVisitFunc func, void* user_data) {
+    const uint32_t width = grid->cell_count.x;
+    CellRange range = csr_grid_cell_range(grid, area);
+    for (int32_t y = range.min_y; y < range.max_y; y++) {
+        uint32_t begin = grid->cell_start[range.min_x+y*width];
+        uint32_t end = grid->cell_start[range.max_x+y*width];
+        for (uint32_t i = begin; i < end; i++) {
+            if (func(user_data, grid->entries[i].id, grid->entries[i].box)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+Vec(uint32_t) csr_grid_query(const CsrGrid* grid, Box area) {
+    Vec(uint32_t) result = NULL;
+    csr_grid_query_into(grid, area, &result);
+    return result;
+}
+
+void csr_grid_find_pairs(const CsrGrid* grid, Vec(BoxPair)* pairs) {
+    const uint32_t width = grid->cell_count.x;
+    const uint32_t height = grid->cell_count.y;
+
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            uint32_t begin = grid->cell_start[x+y*width];
+            uint32_t end = grid->cell_start[x+y*width + 1];
+            for (uint32_t i = begin; i < end; i++) {
+                const BoxEntry *a = &grid->entries[i];
+                for (uint32_t j = i+1; j < end; j++) {
+                    const BoxEntry *b = &grid->entries[j];
+                    if (!box_overlapp(a->box, b->box)) {
+                        continue;
+                    }
+
+                    // Only the cell owning the overlap's corner reports it.
+                    Box corner = {
+                        .pos = box_overlapp_min(a->box, b->box),
+                    };
+                    CellRange owner = csr_grid_cell_range(grid, corner);
+                    if ((uint32_t) owner.min_x != x || (uint32_t) owner.min_y != y) {
+                        continue;
+                    }
+
+                    vec_push(*pairs, box_pair(a->id, b->id));
+                }
+            }
+        }
+    }
+}
+
+void csr_grid_debug_draw(const CsrGrid* grid, SDL_Renderer *renderer) {
+    const Vec2 cell_size = vec2_div(grid->world_box.size, grid->cell_count);
+    for (uint32_t y = 0; y < grid->cell_count.y; y++) {
+        for (uint32_t x = 0; x < grid->cell_count.x; x++) {
+            SDL_Rect rect = {
+                .x = grid->world_box.pos.x + x*cell_size.x,
+                .y = grid->world_box.pos.y + y*cell_size.y,
+                .w = cell_size.x,
+                .h = cell_size.y,
+            };
+            SDL_RenderDrawRect(renderer, &rect);
+        }
+    }
+}
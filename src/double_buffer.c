@@ -0,0 +1,172 @@
+#include "double_buffer.h"
+#include "strategy_interface.h"
+#include "ds.h"
+
+#include <stdlib.h>
+#include <sched.h>
+
+static void double_buffer_build_generation(DoubleBuffer *buffer) {
+    const uint32_t back = 1 - __atomic_load_n(&buffer->front, __ATOMIC_RELAXED);
+
+    // Readers that saw this generation before the last swap may still be in
+    // it. New readers back out again since it isn't the front.
+    while (__atomic_load_n(&buffer->readers[back], __ATOMIC_SEQ_CST) > 0) {
+        sched_yield();
+    }
+
+    void* data = buffer->generations[back];
+    buffer->strategy->clear(data);
+    for (size_t i = 0; i < vec_len(buffer->building); i++) {
+        buffer->strategy->insert(data, buffer->building[i].id, buffer->building[i].box);
+    }
+    if (buffer->strategy->build != NULL) {
+        buffer->strategy->build(data);
+    }
+
+    __atomic_store_n(&buffer->front, back, __ATOMIC_SEQ_CST);
+}
+
+static void* double_buffer_builder_main(void* arg) {
+    DoubleBuffer *buffer = arg;
+
+    pthread_mutex_lock(&buffer->mutex);
+    while (true) {
+        while (!buffer->quit && !buffer->pending) {
+            pthread_cond_wait(&buffer->start, &buffer->mutex);
+        }
+        if (!buffer->pending) {
+            break;
+        }
+        pthread_mutex_unlock(&buffer->mutex);
+
+        double_buffer_build_generation(buffer);
+
+        pthread_mutex_lock(&buffer->mutex);
+        buffer->pending = false;
+        pthread_cond_broadcast(&buffer->done);
+    }
+    pthread_mutex_unlock(&buffer->mutex);
+
+    return NULL;
+}
+
+DoubleBuffer* double_buffer_new(const DoubleBufferDesc* desc) {
+    DoubleBuffer* buffer = malloc(sizeof(DoubleBuffer));
+    *buffer = (DoubleBuffer) {
+        .strategy = desc->strategy,
+        .generations = {
+            desc->strategy->new(desc->desc),
+            desc->strategy->new(desc->desc),
+        },
+        .readers = calloc(2, sizeof(uint32_t)),
+    };
+    pthread_mutex_init(&buffer->mutex, NULL);
+    pthread_cond_init(&buffer->start, NULL);
+    pthread_cond_init(&buffer->done, NULL);
+    pthread_create(&buffer->thread, NULL, double_buffer_builder_main, buffer);
+    return buffer;
+}
+
+void double_buffer_free(DoubleBuffer *buffer) {
+    // A pending build is finished first.
+    pthread_mutex_lock(&buffer->mutex);
+    buffer->quit = true;
+    pthread_cond_signal(&buffer->start);
+    pthread_mutex_unlock(&buffer->mutex);
+    pthread_join(buffer->thread, NULL);
+
+    pthread_cond_destroy(&buffer->done);
+    pthread_cond_destroy(&buffer->start);
+    pthread_mutex_destroy(&buffer->mutex);
+
+    buffer->strategy->free(buffer->generations[0]);
+    buffer->strategy->free(buffer->generations[1]);
+    free(buffer->readers);
+    vec_free(buffer->staged);
+    vec_free(buffer->building);
+    free(buffer);
+}
+
+void double_buffer_insert(DoubleBuffer *buffer, uint32_t id, Box box) {
+    vec_push(buffer->staged, ((BoxEntry) {
+        .box = box,
+        .id = id,
+    }));
+}
+
+void double_buffer_clear(DoubleBuffer *buffer) {
+    vec_clear(buffer->staged);
+}
+
+void double_buffer_build(DoubleBuffer *buffer) {
+    pthread_mutex_lock(&buffer->mutex);
+    while (buffer->pending) {
+        pthread_cond_wait(&buffer->done, &buffer->mutex);
+    }
+
+    // The builder's old boxes become the next staging buffer.
+    Vec(BoxEntry) building = buffer->building;
+    buffer->building = buffer->staged;
+    buffer->staged = building;
+    vec_clear(buffer->staged);
+
+    buffer->pending = true;
+    pthread_cond_signal(&buffer->start);
+    pthread_mutex_unlock(&buffer->mutex);
+}
+
+void double_buffer_sync(DoubleBuffer *buffer) {
+    pthread_mutex_lock(&buffer->mutex);
+    while (buffer->pending) {
+        pthread_cond_wait(&buffer->done, &buffer->mutex);
+    }
+    pthread_mutex_unlock(&buffer->mutex);
+}
+
+// Enters the current generation. Only retries when the builder swapped in a
+// new one in between.
+static uint32_t double_buffer_acquire(const DoubleBuffer* buffer) {
+    while (true) {
+        uint32_t front = __atomic_load_n(&buffer->front, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&buffer->readers[front], 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&buffer->front, __ATOMIC_SEQ_CST) == front) {
+            return front;
+        }
+        __atomic_fetch_sub(&buffer->readers[front], 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void double_buffer_release(const DoubleBuffer* buffer, uint32_t front) {
+    __atomic_fetch_sub(&buffer->readers[front], 1, __ATOMIC_RELEASE);
+}
+
+Vec(uint32_t) double_buffer_query(const DoubleBuffer* buffer, Box area) {
+    Vec(uint32_t) result = NULL;
+    double_buffer_query_into(buffer, area, &result);
+    return result;
+}
+
+void double_buffer_query_into(const DoubleBuffer* buffer, Box area, Vec(uint32_t)* result) {
+    uint32_t front = double_buffer_acquire(buffer);
+    buffer->strategy->query_into(buffer->generations[front], area, result);
+    double_buffer_release(buffer, front);
+}
+
+bool double_buffer_query_visit(const DoubleBuffer* buffer, Box area, BoxVisitFunc func, void* user_data) {
+    uint32_t front = double_buffer_acquire(buffer);
+    bool stopped = buffer->strategy->visit(buffer->generations[front], area, func, user_data);
+    double_buffer_release(buffer, front);
+    return stopped;
+}
+
+void double_buffer_find_pairs(const DoubleBuffer* buffer, Vec(BoxPair)* pairs) {
+    uint32_t front = double_buffer_acquire(buffer);
+    buffer->strategy->find_pairs(buffer->generations[front], pairs);
+    double_buffer_release(buffer, front);
+}
+
+void double_buffer_debug_draw(const DoubleBuffer* buffer, SDL_Renderer *renderer) {
+    uint32_t front = double_buffer_acquire(buffer);
+    buffer->strategy->debug_draw(buffer->generations[front], renderer);
+    double_buffer_release(buffer, front);
+}
@@ -46,6 +46,14 @@ size_t vec_element_size(const void *vec) {
     return vec_to_header(vec)->element_size;
 }
 
+void vec_clear(void *vec) {
+    if (vec == NULL) {
+        return;
+    }
+
+    vec_to_header(vec)->len = 0;
+}
+
 void *vec_new(size_t element_size) {
     VecHeader *header = malloc(sizeof(VecHeader) + element_size*VEC_INITIAL_CAPACITY);
     *header = (VecHeader) {
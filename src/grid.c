@@ -1,10 +1,31 @@
 #include "grid.h"
+#include "cell_range.h"
 #include "ds.h"
 
 #include <stdlib.h>
 #include <math.h>
 #include <stdio.h>
 
+static CellRange grid_cell_range(const Grid* grid, Box box) {
+    return cell_range(box, vec2s(0.0f), vec2_div(grid->world_box.size, grid->cell_count));
+}
+
+static BoxEntry *cell_entry(const Cell *cell, uint32_t i) {
+    if (i < GRID_MAX_BOX_COUNT) {
+        return (BoxEntry *) &cell->entries[i];
+    }
+    return &cell->overflow[i - GRID_MAX_BOX_COUNT];
+}
+
+static BoxEntry *cell_find(Cell *cell, uint32_t id) {
+    for (uint32_t i = 0; i < cell->entry_i; i++) {
+        if (cell_entry(cell, i)->id == id) {
+            return cell_entry(cell, i);
+        }
+    }
+    return NULL;
+}
+
 Grid* grid_new(const GridDesc* desc) {
     Grid* grid = malloc(sizeof(Grid));
     *grid = (Grid) {
@@ -16,60 +37,176 @@ Grid* grid_new(const GridDesc* desc) {
 }
 
 void grid_free(Grid *grid) {
+    for (uint32_t i = 0; i < grid->cell_count.x*grid->cell_count.y; i++) {
+        vec_free(grid->cells[i].overflow);
+    }
     free(grid->cells);
+    vec_free(grid->boxes);
+    vec_free(grid->present);
+    vec_free(grid->dirty_cells);
 }
 
-void grid_insert(Grid *grid, Box box) {
-    const Vec2 cell_size = vec2_div(grid->world_box.size, grid->cell_count);
+static bool grid_contains(const Grid *grid, uint32_t id) {
+    return id < vec_len(grid->present) && grid->present[id];
+}
 
-    Vec2 top_left = vec2_div(box.pos, cell_size);
-    top_left.x = floorf(top_left.x);
-    top_left.y = floorf(top_left.y);
+void grid_insert(Grid *grid, uint32_t id, Box box) {
+    // Inserting an id twice moves it instead of storing it twice.
+    if (grid_contains(grid, id)) {
+        grid_remove(grid, id);
+    }
+    if (id >= vec_len(grid->boxes)) {
+        vec_insert_arr(grid->present, vec_len(grid->present), NULL, id+1 - vec_len(grid->present));
+        vec_insert_arr(grid->boxes, vec_len(grid->boxes), NULL, id+1 - vec_len(grid->boxes));
+    }
+    grid->boxes[id] = box;
+    grid->present[id] = true;
+
+    CellRange range = grid_cell_range(grid, box);
+    for (int32_t y = range.min_y; y < range.max_y; y++) {
+        for (int32_t x = range.min_x; x < range.max_x; x++) {
+            Cell *cell = &grid->cells[x+y*(int) grid->cell_count.x];
+            if (!cell->dirty) {
+                cell->dirty = true;
+                vec_push(grid->dirty_cells, x+y*(int) grid->cell_count.x);
+            }
+            BoxEntry entry = {
+                .box = box,
+                .id = id,
+            };
+            if (cell->entry_i < GRID_MAX_BOX_COUNT) {
+                cell->entries[cell->entry_i] = entry;
+            } else {
+                vec_push(cell->overflow, entry);
+                grid->overflow_count++;
+            }
+            cell->entry_i++;
+        }
+    }
+}
 
-    Vec2 bottom_right = vec2_div(vec2_add(box.pos, box.size), cell_size);
-    bottom_right.x = ceilf(bottom_right.x);
-    bottom_right.y = ceilf(bottom_right.y);
+void grid_remove(Grid *grid, uint32_t id) {
+    if (!grid_contains(grid, id)) {
+        return;
+    }
+    grid->present[id] = false;
 
-    for (int32_t y = top_left.y; y < bottom_right.y; y++) {
-        for (int32_t x = top_left.x; x < bottom_right.x; x++) {
+    CellRange range = grid_cell_range(grid, grid->boxes[id]);
+    for (int32_t y = range.min_y; y < range.max_y; y++) {
+        for (int32_t x = range.min_x; x < range.max_x; x++) {
             Cell *cell = &grid->cells[x+y*(int) grid->cell_count.x];
-            cell->boxes[cell->box_i++] = box;
-            if (cell->box_i >= GRID_MAX_BOX_COUNT) {
-                printf("WARN: Exceeding max cell capacity.");
-                exit(1);
+            BoxEntry *entry = cell_find(cell, id);
+            if (entry == NULL) {
+                continue;
+            }
+            *entry = *cell_entry(cell, --cell->entry_i);
+            if (cell->entry_i >= GRID_MAX_BOX_COUNT) {
+                vec_pop(cell->overflow);
             }
         }
     }
 }
 
-Vec(Box) grid_query(const Grid* grid, Box area) {
-    const Vec2 cell_size = vec2_div(grid->world_box.size, grid->cell_count);
+void grid_update(Grid *grid, uint32_t id, Box box) {
+    if (!grid_contains(grid, id)) {
+        return;
+    }
+
+    CellRange old_range = grid_cell_range(grid, grid->boxes[id]);
+    CellRange new_range = grid_cell_range(grid, box);
+
+    // Still covering the same cells, only the stored bounds need refreshing.
+    if (cell_range_eq(old_range, new_range)) {
+        grid->boxes[id] = box;
+        for (int32_t y = new_range.min_y; y < new_range.max_y; y++) {
+            for (int32_t x = new_range.min_x; x < new_range.max_x; x++) {
+                Cell *cell = &grid->cells[x+y*(int) grid->cell_count.x];
+                BoxEntry *entry = cell_find(cell, id);
+                if (entry != NULL) {
+                    entry->box = box;
+                }
+            }
+        }
+        return;
+    }
 
-    Vec2 top_left = vec2_div(area.pos, cell_size);
-    top_left.x = floorf(top_left.x);
-    top_left.y = floorf(top_left.y);
+    grid_remove(grid, id);
+    grid_insert(grid, id, box);
+}
 
-    Vec2 bottom_right = vec2_div(vec2_add(area.pos, area.size), cell_size);
-    bottom_right.x = ceilf(bottom_right.x);
-    bottom_right.y = ceilf(bottom_right.y);
+void grid_query_into(const Grid* grid, Box area, Vec(uint32_t)* result) {
+    CellRange range = grid_cell_range(grid, area);
+    for (int32_t y = range.min_y; y < range.max_y; y++) {
+        for (int32_t x = range.min_x; x < range.max_x; x++) {
+            const Cell *cell = &grid->cells[x+y*(int) grid->cell_count.x];
+            for (uint32_t i = 0; i < cell->entry_i; i++) {
+                vec_push(*result, cell_entry(cell, i)->id);
+            }
+        }
+    }
+}
 
-    Vec(Box) result = NULL;
-    for (int32_t y = top_left.y; y < bottom_right.y; y++) {
-        for (int32_t x = top_left.x; x < bottom_right.x; x++) {
-            Cell cell = grid->cells[x+y*(int) grid->cell_count.x];
-            for (uint32_t i = 0; i < cell.box_i; i++) {
-                vec_push(result, cell.boxes[i]);
+bool grid_query_visit(const Grid* grid, Box area, BoxVisitFunc func, void* user_data) {
+    CellRange range = grid_cell_range(grid, area);
+    for (int32_t y = range.min_y; y < range.max_y; y++) {
+        for (int32_t x = range.min_x; x < range.max_x; x++) {
+            const Cell *cell = &grid->cells[x+y*(int) grid->cell_count.x];
+            for (uint32_t i = 0; i < cell->entry_i; i++) {
+                const BoxEntry *entry = cell_entry(cell, i);
+                if (func(user_data, entry->id, entry->box)) {
+                    return true;
+                }
             }
         }
     }
 
+    return false;
+}
+
+Vec(uint32_t) grid_query(const Grid* grid, Box area) {
+    Vec(uint32_t) result = NULL;
+    grid_query_into(grid, area, &result);
     return result;
 }
 
+void grid_find_pairs(const Grid* grid, Vec(BoxPair)* pairs) {
+    const Vec2 cell_size = vec2_div(grid->world_box.size, grid->cell_count);
+    const int32_t width = grid->cell_count.x;
+
+    for (size_t cell_i = 0; cell_i < vec_len(grid->dirty_cells); cell_i++) {
+        const int32_t x = grid->dirty_cells[cell_i] % width;
+        const int32_t y = grid->dirty_cells[cell_i] / width;
+        const Cell *cell = &grid->cells[grid->dirty_cells[cell_i]];
+        for (uint32_t i = 0; i < cell->entry_i; i++) {
+            const BoxEntry *a = cell_entry(cell, i);
+            for (uint32_t j = i+1; j < cell->entry_i; j++) {
+                const BoxEntry *b = cell_entry(cell, j);
+                if (!box_overlapp(a->box, b->box)) {
+                    continue;
+                }
+
+                // Only the cell owning the overlap's corner reports it.
+                Vec2 corner = vec2_div(box_overlapp_min(a->box, b->box), cell_size);
+                if ((int32_t) floorf(corner.x) != x || (int32_t) floorf(corner.y) != y) {
+                    continue;
+                }
+
+                vec_push(*pairs, box_pair(a->id, b->id));
+            }
+        }
+    }
+}
+
 void grid_clear(Grid *grid) {
-    for (uint32_t i = 0; i < grid->cell_count.x*grid->cell_count.y; i++) {
-        grid->cells[i].box_i = 0;
+    vec_clear(grid->boxes);
+    vec_clear(grid->present);
+    for (size_t i = 0; i < vec_len(grid->dirty_cells); i++) {
+        Cell *cell = &grid->cells[grid->dirty_cells[i]];
+        cell->entry_i = 0;
+        vec_clear(cell->overflow);
+        cell->dirty = false;
     }
+    vec_clear(grid->dirty_cells);
 }
 
 void grid_debug_draw(const Grid* grid, SDL_Renderer *renderer) {
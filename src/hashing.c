@@ -1,84 +1,430 @@
 #include "hashing.h"
+#include "cell_range.h"
 #include <SDL2/SDL_render.h>
 #include <stdlib.h>
 #include <math.h>
 #include <stdio.h>
 
-// https://stackoverflow.com/questions/664014/what-integer-hash-function-are-good-that-accepts-an-integer-hash-key
-static uint64_t hash_position(int32_t x, int32_t y) {
-    uint64_t full = ((uint64_t) x << 32) | y;
-    full = (full ^ (full >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
-    full = (full ^ (full >> 27)) * UINT64_C(0x94d049bb133111eb);
-    full = full ^ (full >> 31);
-    return full;
+static CellRange spatial_hash_cell_range(const SpatialHash* space, Box box) {
+    return cell_range(box, vec2s(0.0f), space->cell_size);
+}
+
+static BoxEntry *bucket_entry(const Bucket *bucket, uint32_t i) {
+    if (i < SPATIAL_HASH_MAX_BOX_COUNT) {
+        return (BoxEntry *) &bucket->entries[i];
+    }
+    return &bucket->overflow[i - SPATIAL_HASH_MAX_BOX_COUNT];
+}
+
+static uint32_t next_pow2(uint32_t value) {
+    uint32_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+// Linear probing for the bucket of a cell. Returns the bucket owning the
+// cell or the empty slot it would go in.
+static uint32_t spatial_hash_probe(const SpatialHash* space, uint64_t key) {
+    const uint32_t mask = space->map_capacity - 1;
+    uint32_t index = cell_hash(key) & mask;
+    while (true) {
+        const Bucket *bucket = &space->buckets[index];
+        if (bucket->key == SPATIAL_HASH_EMPTY_KEY || bucket->key == key) {
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+static const Bucket *spatial_hash_lookup(const SpatialHash* space, int32_t x, int32_t y) {
+    const Bucket *bucket = &space->buckets[spatial_hash_probe(space, cell_key(x, y))];
+    if (bucket->key == SPATIAL_HASH_EMPTY_KEY) {
+        return NULL;
+    }
+    return bucket;
+}
+
+static void spatial_hash_grow(SpatialHash *space) {
+    Bucket *old_buckets = space->buckets;
+
+    space->map_capacity *= 2;
+    space->buckets = calloc(space->map_capacity, sizeof(Bucket));
+
+    // Every used bucket is on the dirty list, so only those are rehashed and
+    // the list is rewritten with their new slots.
+    for (size_t i = 0; i < vec_len(space->dirty_buckets); i++) {
+        const Bucket *old_bucket = &old_buckets[space->dirty_buckets[i]];
+        uint32_t index = spatial_hash_probe(space, old_bucket->key);
+        space->buckets[index] = *old_bucket;
+        space->dirty_buckets[i] = index;
+    }
+
+    free(old_buckets);
+}
+
+static Bucket *spatial_hash_get_or_insert(SpatialHash *space, int32_t x, int32_t y) {
+    const uint64_t key = cell_key(x, y);
+    uint32_t index = spatial_hash_probe(space, key);
+    if (space->buckets[index].key != SPATIAL_HASH_EMPTY_KEY) {
+        return &space->buckets[index];
+    }
+
+    if (vec_len(space->dirty_buckets) + 1 > space->map_capacity * SPATIAL_HASH_FILL_LIMIT) {
+        spatial_hash_grow(space);
+        index = spatial_hash_probe(space, key);
+    }
+
+    Bucket *bucket = &space->buckets[index];
+    bucket->key = key;
+    bucket->entry_i = 0;
+    vec_push(space->dirty_buckets, index);
+    return bucket;
+}
+
+static void spatial_hash_bucket_push(SpatialHash *space, Bucket *bucket, BoxEntry entry) {
+    if (bucket->entry_i < SPATIAL_HASH_MAX_BOX_COUNT) {
+        bucket->entries[bucket->entry_i] = entry;
+    } else {
+        vec_push(bucket->overflow, entry);
+        space->overflow_count++;
+    }
+    bucket->entry_i++;
 }
 
 SpatialHash* spatial_hash_new(const SpatialHashDesc* desc) {
+    uint32_t capacity = next_pow2(desc->map_capacity);
     SpatialHash* space = malloc(sizeof(SpatialHash));
     *space = (SpatialHash) {
         .cell_size = desc->cell_size,
-        .map_capacity = desc->map_capacity,
-        .buckets = calloc(desc->map_capacity, sizeof(Bucket)),
+        .map_capacity = capacity,
+        .buckets = calloc(capacity, sizeof(Bucket)),
+        .thread_pool = desc->thread_pool,
     };
     return space;
 }
 
 void spatial_hash_free(SpatialHash *space) {
+    for (size_t i = 0; i < vec_len(space->dirty_buckets); i++) {
+        vec_free(space->buckets[space->dirty_buckets[i]].overflow);
+    }
     free(space->buckets);
+    vec_free(space->boxes);
+    vec_free(space->present);
+    vec_free(space->dirty_buckets);
+    vec_free(space->staged);
+    for (uint32_t i = 0; i < space->pending_count; i++) {
+        vec_free(space->pending[i]);
+    }
+    free(space->pending);
+}
+
+static void spatial_hash_insert_cells(SpatialHash *space, uint32_t id, Box box) {
+    CellRange range = spatial_hash_cell_range(space, box);
+    for (int32_t y = range.min_y; y < range.max_y; y++) {
+        for (int32_t x = range.min_x; x < range.max_x; x++) {
+            Bucket *bucket = spatial_hash_get_or_insert(space, x, y);
+            spatial_hash_bucket_push(space, bucket, (BoxEntry) {
+                .box = box,
+                .id = id,
+            });
+        }
+    }
 }
 
-void spatial_hash_insert(SpatialHash *space, Box box) {
-    Vec2 min = vec2_div(box.pos, space->cell_size);
-    min.x = floorf(min.x);
-    min.y = floorf(min.y);
-    Vec2 max = vec2_div(vec2_add(box.pos, box.size), space->cell_size);
-    max.x = ceilf(max.x);
-    max.y = ceilf(max.y);
-
-    for (int32_t y = min.y; y < max.y; y++) {
-        for (int32_t x = min.x; x < max.x; x++) {
-            uint64_t hash = hash_position(x, y);
-            uint64_t index = hash % space->map_capacity;
-            Bucket *bucket = &space->buckets[index];
-            bucket->boxes[bucket->box_i++] = box;
-            if (bucket->box_i >= SPATIAL_HASH_MAX_BOX_COUNT) {
-                printf("WARN: Max box count exceeded for spatial hash bucket.\n");
-                exit(1);
+static bool spatial_hash_contains(const SpatialHash *space, uint32_t id) {
+    return id < vec_len(space->present) && space->present[id];
+}
+
+static void spatial_hash_reserve_ids(SpatialHash *space, uint32_t id_count) {
+    if (id_count > vec_len(space->boxes)) {
+        vec_insert_arr(space->present, vec_len(space->present), NULL, id_count - vec_len(space->present));
+        vec_insert_arr(space->boxes, vec_len(space->boxes), NULL, id_count - vec_len(space->boxes));
+    }
+}
+
+void spatial_hash_insert(SpatialHash *space, uint32_t id, Box box) {
+    // Inserting an id twice moves it instead of storing it twice.
+    if (spatial_hash_contains(space, id)) {
+        spatial_hash_remove(space, id);
+    }
+    spatial_hash_reserve_ids(space, id+1);
+    space->boxes[id] = box;
+    space->present[id] = true;
+
+    if (space->thread_pool != NULL) {
+        vec_push(space->staged, ((BoxEntry) {
+            .box = box,
+            .id = id,
+        }));
+        return;
+    }
+    spatial_hash_insert_cells(space, id, box);
+}
+
+void spatial_hash_remove(SpatialHash *space, uint32_t id) {
+    if (!spatial_hash_contains(space, id)) {
+        return;
+    }
+    space->present[id] = false;
+
+    // Staged boxes have to be in the map before they can be found.
+    spatial_hash_build(space);
+
+    CellRange range = spatial_hash_cell_range(space, space->boxes[id]);
+    for (int32_t y = range.min_y; y < range.max_y; y++) {
+        for (int32_t x = range.min_x; x < range.max_x; x++) {
+            // Emptied buckets keep their cell until the next clear.
+            Bucket *bucket = &space->buckets[spatial_hash_probe(space, cell_key(x, y))];
+            if (bucket->key == SPATIAL_HASH_EMPTY_KEY) {
+                continue;
+            }
+            for (uint32_t i = 0; i < bucket->entry_i; i++) {
+                if (bucket_entry(bucket, i)->id == id) {
+                    *bucket_entry(bucket, i) = *bucket_entry(bucket, --bucket->entry_i);
+                    if (bucket->entry_i >= SPATIAL_HASH_MAX_BOX_COUNT) {
+                        vec_pop(bucket->overflow);
+                    }
+                    break;
+                }
             }
         }
     }
 }
 
+void spatial_hash_update(SpatialHash *space, uint32_t id, Box box) {
+    if (!spatial_hash_contains(space, id)) {
+        return;
+    }
+    spatial_hash_build(space);
+
+    CellRange old_range = spatial_hash_cell_range(space, space->boxes[id]);
+    CellRange new_range = spatial_hash_cell_range(space, box);
+
+    // Still covering the same cells, only the stored bounds need refreshing.
+    if (cell_range_eq(old_range, new_range)) {
+        space->boxes[id] = box;
+        for (int32_t y = new_range.min_y; y < new_range.max_y; y++) {
+            for (int32_t x = new_range.min_x; x < new_range.max_x; x++) {
+                Bucket *bucket = &space->buckets[spatial_hash_probe(space, cell_key(x, y))];
+                for (uint32_t i = 0; i < bucket->entry_i; i++) {
+                    if (bucket_entry(bucket, i)->id == id) {
+                        bucket_entry(bucket, i)->box = box;
+                        break;
+                    }
+                }
+            }
+        }
+        return;
+    }
+
+    spatial_hash_remove(space, id);
+    space->boxes[id] = box;
+    space->present[id] = true;
+    spatial_hash_insert_cells(space, id, box);
+}
+
 void spatial_hash_clear(SpatialHash *space) {
-    for (uint32_t i = 0; i < space->map_capacity; i++) {
-        space->buckets[i].box_i = 0;
+    vec_clear(space->boxes);
+    vec_clear(space->present);
+    for (size_t i = 0; i < vec_len(space->dirty_buckets); i++) {
+        Bucket *bucket = &space->buckets[space->dirty_buckets[i]];
+        // Concurrent inserts rely on empty buckets having no entries.
+        bucket->key = SPATIAL_HASH_EMPTY_KEY;
+        bucket->entry_i = 0;
+        // Freed rather than kept, a later grow only carries used buckets over.
+        vec_free(bucket->overflow);
+    }
+    vec_clear(space->dirty_buckets);
+    vec_clear(space->staged);
+}
+
+void spatial_hash_begin_insert(SpatialHash *space, uint32_t id_count, uint32_t thread_count) {
+    spatial_hash_reserve_ids(space, id_count);
+
+    // Every bucket gets claimed at most once, so this is room for all of
+    // them. The fill limit is only checked before a claim, a few threads can
+    // go past it at once.
+    space->claimed_count = vec_len(space->dirty_buckets);
+    vec_insert_arr(space->dirty_buckets, vec_len(space->dirty_buckets), NULL, space->map_capacity - vec_len(space->dirty_buckets));
+
+    if (thread_count > space->pending_count) {
+        space->pending = realloc(space->pending, thread_count * sizeof(Vec(SpatialHashPending)));
+        for (uint32_t i = space->pending_count; i < thread_count; i++) {
+            space->pending[i] = NULL;
+        }
+        space->pending_count = thread_count;
+    }
+}
+
+// Concurrent version of 'spatial_hash_get_or_insert', returns NULL when a new
+// bucket would go past the fill limit. Every empty bucket on the probe
+// sequence gets one key swapped in, so a cell never ends up in two buckets.
+// A thread losing the swap gets the winner's key back and moves on.
+static Bucket *spatial_hash_claim(SpatialHash *space, int32_t x, int32_t y) {
+    const uint64_t key = cell_key(x, y);
+    const uint32_t mask = space->map_capacity - 1;
+    uint32_t index = cell_hash(key) & mask;
+    for (uint32_t probe = 0; probe < space->map_capacity; probe++) {
+        Bucket *bucket = &space->buckets[index];
+        uint64_t found = __atomic_load_n(&bucket->key, __ATOMIC_RELAXED);
+        if (found == SPATIAL_HASH_EMPTY_KEY) {
+            if (__atomic_load_n(&space->claimed_count, __ATOMIC_RELAXED) + 1 > space->map_capacity * SPATIAL_HASH_FILL_LIMIT) {
+                return NULL;
+            }
+            // Empty buckets have no entries, so the key is all there is to
+            // write.
+            if (__atomic_compare_exchange_n(&bucket->key, &found, key, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                uint32_t slot = __atomic_fetch_add(&space->claimed_count, 1, __ATOMIC_RELAXED);
+                space->dirty_buckets[slot] = index;
+                return bucket;
+            }
+        }
+
+        if (found == key) {
+            return bucket;
+        }
+        index = (index + 1) & mask;
+    }
+    return NULL;
+}
+
+static bool spatial_hash_bucket_reserve(Bucket *bucket, BoxEntry entry) {
+    uint32_t slot = __atomic_load_n(&bucket->entry_i, __ATOMIC_RELAXED);
+    do {
+        // Growing the overflow isn't thread safe.
+        if (slot >= SPATIAL_HASH_MAX_BOX_COUNT) {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&bucket->entry_i, &slot, slot + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    bucket->entries[slot] = entry;
+    return true;
+}
+
+void spatial_hash_insert_concurrent(SpatialHash *space, uint32_t thread, uint32_t id, Box box) {
+    space->boxes[id] = box;
+    space->present[id] = true;
+
+    CellRange range = spatial_hash_cell_range(space, box);
+    for (int32_t y = range.min_y; y < range.max_y; y++) {
+        for (int32_t x = range.min_x; x < range.max_x; x++) {
+            BoxEntry entry = {
+                .box = box,
+                .id = id,
+            };
+            Bucket *bucket = spatial_hash_claim(space, x, y);
+            if (bucket == NULL || !spatial_hash_bucket_reserve(bucket, entry)) {
+                vec_push(space->pending[thread], ((SpatialHashPending) {
+                    .x = x,
+                    .y = y,
+                    .entry = entry,
+                }));
+            }
+        }
+    }
+}
+
+void spatial_hash_publish(SpatialHash *space) {
+    const size_t claimed_count = __atomic_load_n(&space->claimed_count, __ATOMIC_ACQUIRE);
+    vec_remove_arr(space->dirty_buckets, claimed_count, vec_len(space->dirty_buckets) - claimed_count, NULL);
+
+    for (uint32_t thread = 0; thread < space->pending_count; thread++) {
+        Vec(SpatialHashPending) pending = space->pending[thread];
+        for (size_t i = 0; i < vec_len(pending); i++) {
+            spatial_hash_bucket_push(space, spatial_hash_get_or_insert(space, pending[i].x, pending[i].y), pending[i].entry);
+        }
+        vec_clear(space->pending[thread]);
+    }
+}
+
+static void spatial_hash_build_task(void* user_data, uint32_t task, uint32_t thread) {
+    SpatialHash *space = user_data;
+    const size_t count = vec_len(space->staged);
+    const size_t slice = (count + space->thread_pool->thread_count - 1) / space->thread_pool->thread_count;
+    const size_t begin = task * slice;
+    const size_t end = begin + slice < count ? begin + slice : count;
+    for (size_t i = begin; i < end; i++) {
+        spatial_hash_insert_concurrent(space, thread, space->staged[i].id, space->staged[i].box);
     }
 }
 
-Vec(Box) spatial_hash_query(const SpatialHash* space, Box area) {
-    Vec(Box) result = NULL;
+void spatial_hash_build(SpatialHash *space) {
+    if (vec_len(space->staged) == 0) {
+        return;
+    }
 
-    Vec2 min = vec2_div(area.pos, space->cell_size);
-    min.x = floorf(min.x);
-    min.y = floorf(min.y);
-    Vec2 max = vec2_div(vec2_add(area.pos, area.size), space->cell_size);
-    max.x = ceilf(max.x);
-    max.y = ceilf(max.y);
+    spatial_hash_begin_insert(space, vec_len(space->boxes), space->thread_pool->thread_count);
+    thread_pool_run(space->thread_pool, spatial_hash_build_task, space, space->thread_pool->thread_count);
+    spatial_hash_publish(space);
+    vec_clear(space->staged);
+}
 
-    for (int32_t y = min.y; y < max.y; y++) {
-        for (int32_t x = min.x; x < max.x; x++) {
-            uint64_t hash = hash_position(x, y);
-            uint64_t index = hash % space->map_capacity;
-            Bucket *bucket = &space->buckets[index];
-            for (uint32_t i = 0; i < bucket->box_i; i++) {
-                vec_push(result, bucket->boxes[i]);
+void spatial_hash_query_into(const SpatialHash* space, Box area, Vec(uint32_t)* result) {
+    CellRange range = spatial_hash_cell_range(space, area);
+    for (int32_t y = range.min_y; y < range.max_y; y++) {
+        for (int32_t x = range.min_x; x < range.max_x; x++) {
+            const Bucket *bucket = spatial_hash_lookup(space, x, y);
+            if (bucket == NULL) {
+                continue;
+            }
+            for (uint32_t i = 0; i < bucket->entry_i; i++) {
+                vec_push(*result, bucket_entry(bucket, i)->id);
             }
         }
     }
+}
 
+bool spatial_hash_query_visit(const SpatialHash* space, Box area, BoxVisitFunc func, void* user_data) {
+    CellRange range = spatial_hash_cell_range(space, area);
+    for (int32_t y = range.min_y; y < range.max_y; y++) {
+        for (int32_t x = range.min_x; x < range.max_x; x++) {
+            const Bucket *bucket = spatial_hash_lookup(space, x, y);
+            if (bucket == NULL) {
+                continue;
+            }
+            for (uint32_t i = 0; i < bucket->entry_i; i++) {
+                const BoxEntry *entry = bucket_entry(bucket, i);
+                if (func(user_data, entry->id, entry->box)) {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+Vec(uint32_t) spatial_hash_query(const SpatialHash* space, Box area) {
+    Vec(uint32_t) result = NULL;
+    spatial_hash_query_into(space, area, &result);
     return result;
 }
 
+void spatial_hash_find_pairs(const SpatialHash* space, Vec(BoxPair)* pairs) {
+    for (size_t bucket_i = 0; bucket_i < vec_len(space->dirty_buckets); bucket_i++) {
+        const Bucket *bucket = &space->buckets[space->dirty_buckets[bucket_i]];
+        for (uint32_t i = 0; i < bucket->entry_i; i++) {
+            const BoxEntry *a = bucket_entry(bucket, i);
+            for (uint32_t j = i+1; j < bucket->entry_i; j++) {
+                const BoxEntry *b = bucket_entry(bucket, j);
+                if (!box_overlapp(a->box, b->box)) {
+                    continue;
+                }
+
+                // Only the cell owning the overlap's corner reports it.
+                Vec2 corner = vec2_div(box_overlapp_min(a->box, b->box), space->cell_size);
+                if (cell_key((int32_t) floorf(corner.x), (int32_t) floorf(corner.y)) != bucket->key) {
+                    continue;
+                }
+
+                vec_push(*pairs, box_pair(a->id, b->id));
+            }
+        }
+    }
+}
+
 void spatial_hash_debug_draw(const SpatialHash* space, SDL_Renderer *renderer) {
     int32_t vertical_count;
     int32_t horizontal_count;
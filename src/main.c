@@ -10,6 +10,8 @@
 #include "quadtree.h"
 #include "grid.h"
 #include "strategy_interface.h"
+#include "thread_pool.h"
+#include "collision_driver.h"
 
 #include <stdio.h>
 #include <time.h>
@@ -23,6 +25,7 @@
 #include <SDL2/SDL_timer.h>
 
 static bool run_visually = true;
+static CollisionDriver* collision_driver = NULL;
 
 static float frand(void) {
     return (float) rand() / RAND_MAX;
@@ -31,6 +34,8 @@ static float frand(void) {
 typedef struct Config Config;
 struct Config {
     uint32_t box_size;
+    // Threads querying in the parallel collision phase, 0 for one per core.
+    uint32_t thread_count;
     struct {
         uint32_t count;
         uint32_t init_box_count;
@@ -44,6 +49,7 @@ struct Config {
 
 const Config config = {
     .box_size = 2,
+    .thread_count = 0,
     .iter = {
         .count = 32,
         .init_box_count = 10,
@@ -98,7 +104,125 @@ static void init_boxes(Vec(Box) *boxes, uint32_t count, RandomPointsFunc rand_po
     free(pos);
 }
 
+// The composite strategy treats three out of four boxes as static terrain.
+static bool is_static_box(void* user_data, uint32_t id, Box box) {
+    (void) user_data;
+    (void) box;
+    return id % 4 != 0;
+}
+
+#ifndef NDEBUG
+static int pair_cmp(const void* a, const void* b) {
+    const BoxPair* pair_a = a;
+    const BoxPair* pair_b = b;
+    if (pair_a->a != pair_b->a) {
+        return (pair_a->a > pair_b->a) - (pair_a->a < pair_b->a);
+    }
+    return (pair_a->b > pair_b->b) - (pair_a->b < pair_b->b);
+}
+
+// Both phases have to find the same pairs, in any order.
+static void compare_pairs(const char* name, Vec(BoxPair) pairs, Vec(BoxPair) parallel_pairs) {
+    if (vec_len(pairs) > 1) {
+        qsort(pairs, vec_len(pairs), sizeof(BoxPair), pair_cmp);
+    }
+    if (vec_len(parallel_pairs) > 1) {
+        qsort(parallel_pairs, vec_len(parallel_pairs), sizeof(BoxPair), pair_cmp);
+    }
+
+    bool same = vec_len(pairs) == vec_len(parallel_pairs);
+    for (size_t i = 0; same && i < vec_len(pairs); i++) {
+        same = pair_cmp(&pairs[i], &parallel_pairs[i]) == 0;
+    }
+    if (!same) {
+        printf("%s: the parallel collision found different pairs, %zu instead of %zu\n", name, vec_len(parallel_pairs), vec_len(pairs));
+    }
+}
+
+static bool contains_id(const Vec(uint32_t) ids, uint32_t id) {
+    for (size_t i = 0; i < vec_len(ids); i++) {
+        if (ids[i] == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The benchmark only inserts and clears, so update and remove are checked
+// once per strategy. Half of every fourth box is moved onto another box, the
+// other half is removed twice, along with ids that were never inserted. The
+// rest is left alone, the composite keeps it in a static layer.
+static void check_update_remove(Strategy strat, const void* desc, const char* name, RandomPointsFunc rand_points_func) {
+    if (strat.update == NULL || strat.remove == NULL) {
+        return;
+    }
+
+    Vec(Box) boxes = NULL;
+    init_boxes(&boxes, config.iter.max_box_count, rand_points_func);
+    const uint32_t count = vec_len(boxes);
+    bool* removed = calloc(count, sizeof(bool));
+
+    void* data = strat.new(desc);
+    for (uint32_t i = 0; i < count; i++) {
+        strat.insert(data, i, boxes[i]);
+    }
+    for (uint32_t i = 0; i < count; i += 4) {
+        if (i % 8 == 0) {
+            boxes[i] = boxes[count-1 - i];
+            strat.update(data, i, boxes[i]);
+        } else {
+            strat.remove(data, i);
+            strat.remove(data, i);
+            removed[i] = true;
+        }
+    }
+    strat.remove(data, count);
+    strat.update(data, count+1, boxes[0]);
+    if (strat.build != NULL) {
+        strat.build(data);
+    }
+    if (strat.sync != NULL) {
+        strat.sync(data);
+    }
+
+    size_t errors = 0;
+    Vec(uint32_t) found = NULL;
+    for (uint32_t i = 0; i < count; i++) {
+        vec_clear(found);
+        strat.query_into(data, boxes[i], &found);
+        if (!removed[i] && !contains_id(found, i)) {
+            errors++;
+        }
+        for (size_t j = 0; j < vec_len(found); j++) {
+            if (found[j] >= count || removed[found[j]]) {
+                errors++;
+            }
+        }
+    }
+    Vec(BoxPair) pairs = NULL;
+    strat.find_pairs(data, &pairs);
+    for (size_t i = 0; i < vec_len(pairs); i++) {
+        if (pairs[i].a >= count || pairs[i].b >= count || removed[pairs[i].a] || removed[pairs[i].b]) {
+            errors++;
+        }
+    }
+    if (errors > 0) {
+        printf("%s: %zu errors after update and remove\n", name, errors);
+    }
+
+    vec_free(pairs);
+    vec_free(found);
+    strat.free(data);
+    free(removed);
+    vec_free(boxes);
+}
+#endif
+
 static void run(Window* window, Strategy strat, const void* desc, const char* name, RandomPointsFunc rand_points_func) {
+#ifndef NDEBUG
+    check_update_remove(strat, desc, name, rand_points_func);
+#endif
+
     for (uint32_t box_count = config.iter.init_box_count; box_count <= config.iter.max_box_count; box_count BOX_INCREASE) {
         printf("%s: Benchmarking %u boxes with %u iterations...\n", name, box_count, config.iter.count);
 
@@ -107,44 +231,71 @@ static void run(Window* window, Strategy strat, const void* desc, const char* na
 
         void* data = strat.new(desc);
 
+        // Reused across iterations so the collision phase doesn't allocate
+        // once the buffers have grown large enough.
+        Vec(BoxPair) pairs = NULL;
+        Vec(BoxPair) parallel_pairs = NULL;
+        bool* collided = malloc(vec_len(boxes) * sizeof(bool));
+        Vec(Box) colliding_boxes = NULL;
+        Vec(Box) non_colliding_boxes = NULL;
+
         bm_begin("%u", box_count);
         for (size_t i = 0; i < config.iter.count; i++) {
             // Insert all the boxes into the space.
             bm_begin("insert");
             for (size_t i = 0; i < vec_len(boxes); i++) {
-                strat.insert(data, boxes[i]);
+                strat.insert(data, i, boxes[i]);
+            }
+            if (strat.build != NULL) {
+                strat.build(data);
             }
             bm_end();
 
+            // Timed on its own, it's the part of a background build the
+            // caller still waits for.
+            if (strat.sync != NULL) {
+                bm_begin("sync");
+                strat.sync(data);
+                bm_end();
+            }
+
             // Check for collisions.
             bm_begin("collision");
-            Vec(Box) colliding_boxes = NULL;
-            Vec(Box) non_colliding_boxes = NULL;
-            for (size_t i = 0; i < vec_len(boxes); i++) {
-                // Query
-                bm_begin("query");
-                Vec(Box) near = strat.query(data, boxes[i]);
-                bm_end();
+            vec_clear(colliding_boxes);
+            vec_clear(non_colliding_boxes);
+            vec_clear(pairs);
+            memset(collided, 0, vec_len(boxes) * sizeof(bool));
 
-                bool collided = false;
-                for (size_t j = 0; j < vec_len(near); j++) {
-                    if (box_eq(boxes[i], near[j])) {
-                        continue;
-                    }
-
-                    if (box_overlapp(boxes[i], near[j])) {
-                        vec_push(colliding_boxes, boxes[i]);
-                        collided = true;
-                        break;
-                    }
-                }
-                vec_free(near);
-                if (!collided) {
+            bm_begin("find pairs");
+            strat.find_pairs(data, &pairs);
+            bm_end();
+
+            for (size_t i = 0; i < vec_len(pairs); i++) {
+                collided[pairs[i].a] = true;
+                collided[pairs[i].b] = true;
+            }
+            for (size_t i = 0; i < vec_len(boxes); i++) {
+                if (collided[i]) {
+                    vec_push(colliding_boxes, boxes[i]);
+                } else {
                     vec_push(non_colliding_boxes, boxes[i]);
                 }
             }
             bm_end();
 
+            // The same pairs from querying with every box on all threads.
+            bm_begin("parallel collision");
+            vec_clear(parallel_pairs);
+            collision_driver_find_pairs(collision_driver, &strat, data, boxes, vec_len(boxes), &parallel_pairs);
+            bm_end();
+
+#ifndef NDEBUG
+            // Sorting isn't free, so only the first iteration is checked.
+            if (i == 0) {
+                compare_pairs(name, pairs, parallel_pairs);
+            }
+#endif
+
             // Visualize.
             if (run_visually) {
                 window_clear(*window, color_rgb_hex(0x000000));
@@ -184,12 +335,14 @@ static void run(Window* window, Strategy strat, const void* desc, const char* na
             bm_begin("clear");
             strat.clear(data);
             bm_end();
-
-            vec_free(colliding_boxes);
-            vec_free(non_colliding_boxes);
         }
         bm_end();
 
+        vec_free(pairs);
+        vec_free(parallel_pairs);
+        free(collided);
+        vec_free(colliding_boxes);
+        vec_free(non_colliding_boxes);
         strat.free(data);
         vec_free(boxes);
     }
@@ -204,6 +357,9 @@ int32_t main(void) {
         *window = window_create("Spatial Partitioning", config.world.width, config.world.height);
     }
 
+    ThreadPool* thread_pool = thread_pool_new(config.thread_count);
+    collision_driver = collision_driver_new(thread_pool);
+
     const Box world_box = {
         .pos = {{0.0f, 0.0f}},
         .size = {{config.world.width, config.world.height}},
@@ -224,6 +380,16 @@ int32_t main(void) {
         run(window, STRATEGY_GRID, &grid_desc, "Grid", even_distribution);
         bm_end();
 
+        bm_begin("CSR Grid");
+        run(window, STRATEGY_CSR_GRID, &grid_desc, "CSR Grid", even_distribution);
+        bm_end();
+
+        GridDesc parallel_grid_desc = grid_desc;
+        parallel_grid_desc.thread_pool = thread_pool;
+        bm_begin("Parallel CSR Grid");
+        run(window, STRATEGY_CSR_GRID, &parallel_grid_desc, "Parallel CSR Grid", even_distribution);
+        bm_end();
+
         // Quadtree
         QuadtreeDesc qt_desc = {
             .area = world_box,
@@ -234,6 +400,45 @@ int32_t main(void) {
         run(window, STRATEGY_QUADTREE, &qt_desc, "Quadtree", even_distribution);
         bm_end();
 
+        QuadtreeDesc parallel_qt_desc = qt_desc;
+        parallel_qt_desc.thread_pool = thread_pool;
+        bm_begin("Parallel Quadtree");
+        run(window, STRATEGY_QUADTREE, &parallel_qt_desc, "Parallel Quadtree", even_distribution);
+        bm_end();
+
+        bm_begin("Compact Quadtree");
+        run(window, STRATEGY_COMPACT_QUADTREE, &qt_desc, "Compact Quadtree", even_distribution);
+        bm_end();
+
+        QuadtreeDesc loose_qt_desc = qt_desc;
+        loose_qt_desc.looseness = 0.5f;
+        bm_begin("Loose Quadtree");
+        run(window, STRATEGY_QUADTREE, &loose_qt_desc, "Loose Quadtree", even_distribution);
+        bm_end();
+
+        // Built on a background thread while the previous frame's tree is
+        // queried.
+        DoubleBufferDesc double_qt_desc = {
+            .strategy = &STRATEGY_QUADTREE,
+            .desc = &qt_desc,
+        };
+        bm_begin("Double Buffered Quadtree");
+        run(window, STRATEGY_DOUBLE_BUFFER, &double_qt_desc, "Double Buffered Quadtree", even_distribution);
+        bm_end();
+
+        // AABB tree
+        AabbTreeDesc aabb_desc = {
+            .margin = 2.0f,
+        };
+        bm_begin("AABB Tree");
+        run(window, STRATEGY_AABB_TREE, &aabb_desc, "AABB Tree", even_distribution);
+        bm_end();
+
+        // Static R-tree
+        bm_begin("Static R-Tree");
+        run(window, STRATEGY_STATIC_RTREE, NULL, "Static R-Tree", even_distribution);
+        bm_end();
+
         // Spatial hashing
         SpatialHashDesc sh_desc = {
             .cell_size = vec2s(100.0f),
@@ -243,6 +448,49 @@ int32_t main(void) {
         run(window, STRATEGY_SPATIAL_HASHING, &sh_desc, "Spatial Hashing", even_distribution);
         bm_end();
 
+        SpatialHashDesc parallel_sh_desc = sh_desc;
+        parallel_sh_desc.thread_pool = thread_pool;
+        bm_begin("Concurrent Spatial Hashing");
+        run(window, STRATEGY_SPATIAL_HASHING, &parallel_sh_desc, "Concurrent Spatial Hashing", even_distribution);
+        bm_end();
+
+        bm_begin("Sorted Spatial Hashing");
+        run(window, STRATEGY_SORTED_SPATIAL_HASHING, &sh_desc, "Sorted Spatial Hashing", even_distribution);
+        bm_end();
+
+        bm_begin("Parallel Sorted Spatial Hashing");
+        run(window, STRATEGY_SORTED_SPATIAL_HASHING, &parallel_sh_desc, "Parallel Sorted Spatial Hashing", even_distribution);
+        bm_end();
+
+        // Tiles balanced over the boxes, built and paired on all threads.
+        ShardedDesc sharded_desc = {
+            .strategy = &STRATEGY_SORTED_SPATIAL_HASHING,
+            .desc = &sh_desc,
+            .area = world_box,
+            .column_count = 4,
+            .row_count = 4,
+            .thread_pool = thread_pool,
+        };
+        bm_begin("Sharded Sorted Spatial Hashing");
+        run(window, STRATEGY_SHARDED, &sharded_desc, "Sharded Sorted Spatial Hashing", even_distribution);
+        bm_end();
+
+        // Sweep and prune
+        bm_begin("Sweep and Prune");
+        run(window, STRATEGY_SWEEP_AND_PRUNE, NULL, "Sweep and Prune", even_distribution);
+        bm_end();
+
+        // Static R-tree for the static boxes, spatial hashing for the rest
+        CompositeDesc composite_desc = {
+            .static_strategy = &STRATEGY_STATIC_RTREE,
+            .dynamic_strategy = &STRATEGY_SPATIAL_HASHING,
+            .dynamic_desc = &sh_desc,
+            .is_static = is_static_box,
+        };
+        bm_begin("Composite");
+        run(window, STRATEGY_COMPOSITE, &composite_desc, "Composite", even_distribution);
+        bm_end();
+
         // bm_dump();
         bm_dump_json("benchmark-even.json");
     }
@@ -264,6 +512,16 @@ int32_t main(void) {
         run(window, STRATEGY_GRID, &grid_desc, "Grid", uneven_distribution);
         bm_end();
 
+        bm_begin("CSR Grid");
+        run(window, STRATEGY_CSR_GRID, &grid_desc, "CSR Grid", uneven_distribution);
+        bm_end();
+
+        GridDesc parallel_grid_desc = grid_desc;
+        parallel_grid_desc.thread_pool = thread_pool;
+        bm_begin("Parallel CSR Grid");
+        run(window, STRATEGY_CSR_GRID, &parallel_grid_desc, "Parallel CSR Grid", uneven_distribution);
+        bm_end();
+
         // Quadtree
         QuadtreeDesc qt_desc = {
             .area = world_box,
@@ -274,6 +532,45 @@ int32_t main(void) {
         run(window, STRATEGY_QUADTREE, &qt_desc, "Quadtree", uneven_distribution);
         bm_end();
 
+        QuadtreeDesc parallel_qt_desc = qt_desc;
+        parallel_qt_desc.thread_pool = thread_pool;
+        bm_begin("Parallel Quadtree");
+        run(window, STRATEGY_QUADTREE, &parallel_qt_desc, "Parallel Quadtree", uneven_distribution);
+        bm_end();
+
+        bm_begin("Compact Quadtree");
+        run(window, STRATEGY_COMPACT_QUADTREE, &qt_desc, "Compact Quadtree", uneven_distribution);
+        bm_end();
+
+        QuadtreeDesc loose_qt_desc = qt_desc;
+        loose_qt_desc.looseness = 0.5f;
+        bm_begin("Loose Quadtree");
+        run(window, STRATEGY_QUADTREE, &loose_qt_desc, "Loose Quadtree", uneven_distribution);
+        bm_end();
+
+        // Built on a background thread while the previous frame's tree is
+        // queried.
+        DoubleBufferDesc double_qt_desc = {
+            .strategy = &STRATEGY_QUADTREE,
+            .desc = &qt_desc,
+        };
+        bm_begin("Double Buffered Quadtree");
+        run(window, STRATEGY_DOUBLE_BUFFER, &double_qt_desc, "Double Buffered Quadtree", uneven_distribution);
+        bm_end();
+
+        // AABB tree
+        AabbTreeDesc aabb_desc = {
+            .margin = 2.0f,
+        };
+        bm_begin("AABB Tree");
+        run(window, STRATEGY_AABB_TREE, &aabb_desc, "AABB Tree", uneven_distribution);
+        bm_end();
+
+        // Static R-tree
+        bm_begin("Static R-Tree");
+        run(window, STRATEGY_STATIC_RTREE, NULL, "Static R-Tree", uneven_distribution);
+        bm_end();
+
         // Spatial hashing
         SpatialHashDesc sh_desc = {
             .cell_size = vec2s(100.0f),
@@ -283,9 +580,55 @@ int32_t main(void) {
         run(window, STRATEGY_SPATIAL_HASHING, &sh_desc, "Spatial Hashing", uneven_distribution);
         bm_end();
 
+        SpatialHashDesc parallel_sh_desc = sh_desc;
+        parallel_sh_desc.thread_pool = thread_pool;
+        bm_begin("Concurrent Spatial Hashing");
+        run(window, STRATEGY_SPATIAL_HASHING, &parallel_sh_desc, "Concurrent Spatial Hashing", uneven_distribution);
+        bm_end();
+
+        bm_begin("Sorted Spatial Hashing");
+        run(window, STRATEGY_SORTED_SPATIAL_HASHING, &sh_desc, "Sorted Spatial Hashing", uneven_distribution);
+        bm_end();
+
+        bm_begin("Parallel Sorted Spatial Hashing");
+        run(window, STRATEGY_SORTED_SPATIAL_HASHING, &parallel_sh_desc, "Parallel Sorted Spatial Hashing", uneven_distribution);
+        bm_end();
+
+        // Tiles balanced over the boxes, built and paired on all threads.
+        ShardedDesc sharded_desc = {
+            .strategy = &STRATEGY_SORTED_SPATIAL_HASHING,
+            .desc = &sh_desc,
+            .area = world_box,
+            .column_count = 4,
+            .row_count = 4,
+            .thread_pool = thread_pool,
+        };
+        bm_begin("Sharded Sorted Spatial Hashing");
+        run(window, STRATEGY_SHARDED, &sharded_desc, "Sharded Sorted Spatial Hashing", uneven_distribution);
+        bm_end();
+
+        // Sweep and prune
+        bm_begin("Sweep and Prune");
+        run(window, STRATEGY_SWEEP_AND_PRUNE, NULL, "Sweep and Prune", uneven_distribution);
+        bm_end();
+
+        // Static R-tree for the static boxes, spatial hashing for the rest
+        CompositeDesc composite_desc = {
+            .static_strategy = &STRATEGY_STATIC_RTREE,
+            .dynamic_strategy = &STRATEGY_SPATIAL_HASHING,
+            .dynamic_desc = &sh_desc,
+            .is_static = is_static_box,
+        };
+        bm_begin("Composite");
+        run(window, STRATEGY_COMPOSITE, &composite_desc, "Composite", uneven_distribution);
+        bm_end();
+
         bm_dump_json("benchmark-uneven.json");
     }
 
+    collision_driver_free(collision_driver);
+    thread_pool_free(thread_pool);
+
     if (run_visually) {
         window_destroy(window);
     }
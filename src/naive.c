@@ -9,24 +9,72 @@ Naive* naive_new(const void* desc) {
 }
 
 void naive_free(Naive* data) {
-    vec_free(data->boxes);
+    vec_free(data->entries);
 }
 
-void naive_insert(Naive* data, Box box) {
-    vec_push(data->boxes, box);
+void naive_insert(Naive* data, uint32_t id, Box box) {
+    BoxEntry entry = {
+        .box = box,
+        .id = id,
+    };
+    vec_push(data->entries, entry);
+}
+
+void naive_update(Naive* data, uint32_t id, Box box) {
+    for (size_t i = 0; i < vec_len(data->entries); i++) {
+        if (data->entries[i].id == id) {
+            data->entries[i].box = box;
+            return;
+        }
+    }
+}
+
+void naive_remove(Naive* data, uint32_t id) {
+    for (size_t i = 0; i < vec_len(data->entries); i++) {
+        if (data->entries[i].id == id) {
+            vec_remove_fast(data->entries, i);
+            return;
+        }
+    }
 }
 
 void naive_clear(Naive* data) {
-    vec_free(data->boxes);
+    vec_free(data->entries);
 }
 
-Vec(Box) naive_query(const Naive* data, Box area) {
+void naive_query_into(const Naive* data, Box area, Vec(uint32_t)* result) {
     (void) area;
-    Vec(Box) result = NULL;
-    vec_insert_arr(result, 0, data->boxes, vec_len(data->boxes));
+    for (size_t i = 0; i < vec_len(data->entries); i++) {
+        vec_push(*result, data->entries[i].id);
+    }
+}
+
+Vec(uint32_t) naive_query(const Naive* data, Box area) {
+    Vec(uint32_t) result = NULL;
+    naive_query_into(data, area, &result);
     return result;
 }
 
+bool naive_query_visit(const Naive* data, Box area, BoxVisitFunc func, void* user_data) {
+    (void) area;
+    for (size_t i = 0; i < vec_len(data->entries); i++) {
+        if (func(user_data, data->entries[i].id, data->entries[i].box)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void naive_find_pairs(const Naive* data, Vec(BoxPair)* pairs) {
+    for (size_t i = 0; i < vec_len(data->entries); i++) {
+        for (size_t j = i+1; j < vec_len(data->entries); j++) {
+            if (box_overlapp(data->entries[i].box, data->entries[j].box)) {
+                vec_push(*pairs, box_pair(data->entries[i].id, data->entries[j].id));
+            }
+        }
+    }
+}
+
 void naive_debug_draw(const Naive* data, SDL_Renderer* renderer) {
     (void) data;
     (void) renderer;
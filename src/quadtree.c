@@ -3,99 +3,201 @@
 
 #include <SDL2/SDL_rect.h>
 #include <SDL2/SDL_stdinc.h>
-#include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
-static QuadtreeNode *quadtree_get_node(Quadtree *quadtree, Box area) {
-    QuadtreeNode *node = &quadtree->node_pool[quadtree->node_pool_i++];
+// Entries past 'MAX_BOX_COUNT' live in the node's overflow vector.
+static BoxEntry *node_entry(const QuadtreeNode *node, size_t i) {
+    if (i < MAX_BOX_COUNT) {
+        return (BoxEntry *) &node->entries[i];
+    }
+    return &node->overflow[i - MAX_BOX_COUNT];
+}
+
+static void quadtree_node_push(size_t *overflow_count, QuadtreeNode *node, BoxEntry entry) {
+    if (node->entry_i < MAX_BOX_COUNT) {
+        node->entries[node->entry_i] = entry;
+    } else {
+        vec_push(node->overflow, entry);
+        (*overflow_count)++;
+    }
+    node->entry_i++;
+}
+
+// Keeps the first 'count' entries.
+static void quadtree_node_truncate(QuadtreeNode *node, size_t count) {
+    const size_t overflow_len = count > MAX_BOX_COUNT ? count - MAX_BOX_COUNT : 0;
+    if (vec_len(node->overflow) > overflow_len) {
+        vec_remove_arr(node->overflow, overflow_len, vec_len(node->overflow) - overflow_len, NULL);
+    }
+    node->entry_i = count;
+}
+
+static void quadtree_node_remove_at(QuadtreeNode *node, size_t i) {
+    *node_entry(node, i) = *node_entry(node, --node->entry_i);
+    if (node->entry_i >= MAX_BOX_COUNT) {
+        vec_pop(node->overflow);
+    }
+}
+
+static QuadtreeNode *quadtree_node_init(QuadtreeNode *node, Box area) {
+    // Reused nodes hand their overflow allocation on.
+    Vec(BoxEntry) overflow = node->overflow;
+    vec_clear(overflow);
     *node = (QuadtreeNode) {
+        .overflow = overflow,
         .area = area,
     };
     return node;
 }
 
-static void quadtree_node_insert(Quadtree *quadtree, QuadtreeNode *node, Box box, uint32_t depth) {
-    if (!box_overlapp(box, node->area)) {
+static QuadtreeNode *quadtree_get_node(Quadtree *quadtree, Box area) {
+    QuadtreeNode *node;
+    if (vec_len(quadtree->free_nodes) > 0) {
+        node = vec_pop(quadtree->free_nodes);
+    } else {
+        size_t chunk = quadtree->node_pool_i / QUADTREE_NODE_CHUNK_SIZE;
+        if (chunk == vec_len(quadtree->node_chunks)) {
+            vec_push(quadtree->node_chunks, calloc(QUADTREE_NODE_CHUNK_SIZE, sizeof(QuadtreeNode)));
+        }
+        node = &quadtree->node_chunks[chunk][quadtree->node_pool_i++ % QUADTREE_NODE_CHUNK_SIZE];
+    }
+    return quadtree_node_init(node, area);
+}
+
+// Area of the north west, north east, south west or south east child.
+static Box quadtree_quadrant(Box area, uint32_t quadrant) {
+    return (Box) {
+        .pos = {
+            .x = quadrant & 1 ? area.pos.x + area.size.x/2.0f : area.pos.x,
+            .y = quadrant & 2 ? area.pos.y + area.size.y/2.0f : area.pos.y,
+        },
+        .size = vec2_divs(area.size, 2.0f),
+    };
+}
+
+static void quadtree_node_split(Quadtree *quadtree, QuadtreeNode *node) {
+    node->nw = quadtree_get_node(quadtree, quadtree_quadrant(node->area, 0));
+    node->ne = quadtree_get_node(quadtree, quadtree_quadrant(node->area, 1));
+    node->sw = quadtree_get_node(quadtree, quadtree_quadrant(node->area, 2));
+    node->se = quadtree_get_node(quadtree, quadtree_quadrant(node->area, 3));
+    node->devided = true;
+}
+
+// Bounds of everything stored in or below 'node'. The node's area, grown by
+// the looseness on every side.
+static Box quadtree_node_bounds(const Quadtree *quadtree, const QuadtreeNode *node) {
+    Vec2 margin = vec2_muls(node->area.size, quadtree->looseness);
+    return (Box) {
+        .pos = vec2_sub(node->area.pos, margin),
+        .size = vec2_add(node->area.size, vec2_muls(margin, 2.0f)),
+    };
+}
+
+// Child of a loose node picked by the box's centre, or NULL if the box
+// doesn't fit in that child's bounds and has to stay in 'node'.
+static QuadtreeNode *quadtree_loose_child(const Quadtree *quadtree, const QuadtreeNode *node, Box box) {
+    QuadtreeNode *children[4] = {node->nw, node->ne, node->sw, node->se};
+    Vec2 center = vec2_add(box.pos, vec2_divs(box.size, 2.0f));
+    Vec2 node_center = vec2_add(node->area.pos, vec2_divs(node->area.size, 2.0f));
+    QuadtreeNode *child = children[(center.x >= node_center.x) + (center.y >= node_center.y)*2];
+    if (!box_contains(quadtree_node_bounds(quadtree, child), box)) {
+        return NULL;
+    }
+    return child;
+}
+
+// Node a box is stored in, or would be stored in if inserted now.
+static QuadtreeNode *quadtree_loose_place(const Quadtree *quadtree, Box box) {
+    QuadtreeNode *node = quadtree->root;
+    while (node->devided) {
+        QuadtreeNode *child = quadtree_loose_child(quadtree, node, box);
+        if (child == NULL) {
+            break;
+        }
+        node = child;
+    }
+    return node;
+}
+
+static void quadtree_node_insert(Quadtree *quadtree, QuadtreeNode *node, BoxEntry entry, uint32_t depth) {
+    if (!box_overlapp(entry.box, node->area)) {
         return;
     }
 
     if (depth == quadtree->max_depth-1) {
-        if (node->box_i >= MAX_BOX_COUNT) {
-            printf("WARN: Max box count exceeded for a single quadrant.\n");
-            exit(1);
-        }
-        node->boxes[node->box_i++] = box;
-        return;
-    }
-
-    if (node->box_i == quadtree->max_box_count) {
-        node->nw = quadtree_get_node(quadtree, (Box) {
-                .pos = {
-                    .x = node->area.pos.x,
-                    .y = node->area.pos.y,
-                },
-                .size = vec2_divs(node->area.size, 2.0f),
-            });
-
-        node->ne = quadtree_get_node(quadtree, (Box) {
-                .pos = {
-                    .x = node->area.pos.x + node->area.size.x/2.0f,
-                    .y = node->area.pos.y,
-                },
-                .size = vec2_divs(node->area.size, 2.0f),
-            });
-
-        node->sw = quadtree_get_node(quadtree, (Box) {
-                .pos = {
-                    .x = node->area.pos.x,
-                    .y = node->area.pos.y + node->area.size.y/2.0f,
-                },
-                .size = vec2_divs(node->area.size, 2.0f),
-            });
-
-        node->se = quadtree_get_node(quadtree, (Box) {
-                .pos = {
-                    .x = node->area.pos.x + node->area.size.x/2.0f,
-                    .y = node->area.pos.y + node->area.size.y/2.0f,
-                },
-                .size = vec2_divs(node->area.size, 2.0f),
-            });
-
-        for (size_t i = 0; i < node->box_i; i++) {
-            quadtree_node_insert(quadtree, node->nw, node->boxes[i], depth+1);
-            quadtree_node_insert(quadtree, node->ne, node->boxes[i], depth+1);
-            quadtree_node_insert(quadtree, node->sw, node->boxes[i], depth+1);
-            quadtree_node_insert(quadtree, node->se, node->boxes[i], depth+1);
-        }
-        node->box_i = 0;
-
-        node->devided = true;
+        quadtree_node_push(&quadtree->overflow_count, node, entry);
+        return;
+    }
+
+    if (node->entry_i == quadtree->max_box_count) {
+        quadtree_node_split(quadtree, node);
+        for (size_t i = 0; i < node->entry_i; i++) {
+            const BoxEntry moved = *node_entry(node, i);
+            quadtree_node_insert(quadtree, node->nw, moved, depth+1);
+            quadtree_node_insert(quadtree, node->ne, moved, depth+1);
+            quadtree_node_insert(quadtree, node->sw, moved, depth+1);
+            quadtree_node_insert(quadtree, node->se, moved, depth+1);
+        }
+        quadtree_node_truncate(node, 0);
     }
 
     if (node->devided) {
-        quadtree_node_insert(quadtree, node->nw, box, depth+1);
-        quadtree_node_insert(quadtree, node->ne, box, depth+1);
-        quadtree_node_insert(quadtree, node->sw, box, depth+1);
-        quadtree_node_insert(quadtree, node->se, box, depth+1);
+        quadtree_node_insert(quadtree, node->nw, entry, depth+1);
+        quadtree_node_insert(quadtree, node->ne, entry, depth+1);
+        quadtree_node_insert(quadtree, node->sw, entry, depth+1);
+        quadtree_node_insert(quadtree, node->se, entry, depth+1);
+        return;
+    }
+
+    quadtree_node_push(&quadtree->overflow_count, node, entry);
+}
+
+static void quadtree_node_insert_loose(Quadtree *quadtree, QuadtreeNode *node, BoxEntry entry, uint32_t depth) {
+    while (node->devided) {
+        QuadtreeNode *child = quadtree_loose_child(quadtree, node, entry.box);
+        if (child == NULL) {
+            break;
+        }
+        node = child;
+        depth++;
+    }
+
+    if (!node->devided && node->entry_i == quadtree->max_box_count && depth < quadtree->max_depth-1) {
+        quadtree_node_split(quadtree, node);
+
+        // Move down whatever fits in a child, the rest stays.
+        size_t kept = 0;
+        for (size_t i = 0; i < node->entry_i; i++) {
+            const BoxEntry moved = *node_entry(node, i);
+            QuadtreeNode *child = quadtree_loose_child(quadtree, node, moved.box);
+            if (child != NULL) {
+                quadtree_node_push(&quadtree->overflow_count, child, moved);
+            } else {
+                *node_entry(node, kept++) = moved;
+            }
+        }
+        quadtree_node_truncate(node, kept);
+
+        quadtree_node_insert_loose(quadtree, node, entry, depth);
         return;
     }
 
-    node->boxes[node->box_i++] = box;
+    quadtree_node_push(&quadtree->overflow_count, node, entry);
 }
 
 Quadtree* quadtree_new(const QuadtreeDesc* desc) {
-    size_t max_node_count = powf(4, desc->max_depth);
     Quadtree* quadtree = malloc(sizeof(Quadtree));
     *quadtree = (Quadtree) {
         .max_depth = desc->max_depth,
-        .max_box_count = desc->max_box_count,
-        .node_pool = malloc(max_node_count * sizeof(QuadtreeNode)),
-        .node_pool_i = 1,
-    };
-
-    quadtree->node_pool[0] = (QuadtreeNode) {
-        .area = desc->area,
+        // Nodes split before spilling, so splitting has to happen within the
+        // fixed entries.
+        .max_box_count = desc->max_box_count < MAX_BOX_COUNT ? desc->max_box_count : MAX_BOX_COUNT,
+        .looseness = desc->looseness,
+        .thread_pool = desc->thread_pool,
     };
+    quadtree->root = quadtree_get_node(quadtree, desc->area);
 
     return quadtree;
 }
@@ -116,40 +218,630 @@ Quadtree* quadtree_new(const QuadtreeDesc* desc) {
 // }
 
 void quadtree_free(Quadtree *quadtree) {
-    free(quadtree->node_pool);
+    for (size_t i = 0; i < vec_len(quadtree->node_chunks); i++) {
+        for (size_t j = 0; j < QUADTREE_NODE_CHUNK_SIZE; j++) {
+            vec_free(quadtree->node_chunks[i][j].overflow);
+        }
+        free(quadtree->node_chunks[i]);
+    }
+    vec_free(quadtree->node_chunks);
+    vec_free(quadtree->free_nodes);
+    vec_free(quadtree->boxes);
+    vec_free(quadtree->present);
+    vec_free(quadtree->staged);
+    vec_free(quadtree->top_build.entries);
+    vec_free(quadtree->top_build.masks);
+    vec_free(quadtree->top_build.new_chunks);
+    for (size_t i = 0; i < vec_len(quadtree->builds); i++) {
+        vec_free(quadtree->builds[i].entries);
+        vec_free(quadtree->builds[i].masks);
+        vec_free(quadtree->builds[i].new_chunks);
+    }
+    vec_free(quadtree->builds);
     free(quadtree);
 }
 
-void quadtree_insert(Quadtree *quadtree, Box box) {
-    quadtree_node_insert(quadtree, &quadtree->node_pool[0], box, 0);
+static void quadtree_insert_entry(Quadtree *quadtree, BoxEntry entry) {
+    if (quadtree->looseness > 0.0f) {
+        quadtree_node_insert_loose(quadtree, quadtree->root, entry, 0);
+    } else {
+        quadtree_node_insert(quadtree, quadtree->root, entry, 0);
+    }
 }
 
-void quadtree_clear(Quadtree *quadtree) {
-    quadtree->node_pool_i = 1;
-    quadtree->node_pool[0] = (QuadtreeNode) {
-        .area = quadtree->node_pool[0].area,
+static bool quadtree_contains(const Quadtree *quadtree, uint32_t id) {
+    return id < vec_len(quadtree->present) && quadtree->present[id];
+}
+
+void quadtree_insert(Quadtree *quadtree, uint32_t id, Box box) {
+    // Inserting an id twice moves it instead of storing it twice.
+    if (quadtree_contains(quadtree, id)) {
+        quadtree_remove(quadtree, id);
+    }
+    if (id >= vec_len(quadtree->boxes)) {
+        vec_insert_arr(quadtree->present, vec_len(quadtree->present), NULL, id+1 - vec_len(quadtree->present));
+        vec_insert_arr(quadtree->boxes, vec_len(quadtree->boxes), NULL, id+1 - vec_len(quadtree->boxes));
+    }
+    quadtree->boxes[id] = box;
+    quadtree->present[id] = true;
+
+    BoxEntry entry = {
+        .box = box,
+        .id = id,
     };
+    if (quadtree->thread_pool != NULL) {
+        vec_push(quadtree->staged, entry);
+        return;
+    }
+    quadtree_insert_entry(quadtree, entry);
+}
+
+static bool entries_contain(const BoxEntry *entries, size_t count, uint32_t id) {
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].id == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Pull the children's entries back into 'node' if they all are leaves and
+// their distinct entries, together with the node's own, fit in a single
+// node.
+static void quadtree_node_collapse(Quadtree *quadtree, QuadtreeNode *node) {
+    QuadtreeNode *children[4] = {node->nw, node->ne, node->sw, node->se};
+
+    // Boxes straddling quadrants are stored in several children, so they
+    // have to be deduplicated while merging.
+    if (node->entry_i > quadtree->max_box_count) {
+        return;
+    }
+
+    BoxEntry merged[MAX_BOX_COUNT];
+    memcpy(merged, node->entries, node->entry_i * sizeof(BoxEntry));
+    size_t merged_i = node->entry_i;
+    for (uint32_t i = 0; i < 4; i++) {
+        if (children[i]->devided) {
+            return;
+        }
+
+        for (size_t j = 0; j < children[i]->entry_i; j++) {
+            BoxEntry entry = *node_entry(children[i], j);
+            if (entries_contain(merged, merged_i, entry.id)) {
+                continue;
+            }
+            if (merged_i == quadtree->max_box_count) {
+                return;
+            }
+            merged[merged_i++] = entry;
+        }
+    }
+
+    memcpy(node->entries, merged, merged_i * sizeof(BoxEntry));
+    node->entry_i = merged_i;
+    for (uint32_t i = 0; i < 4; i++) {
+        vec_push(quadtree->free_nodes, children[i]);
+    }
+
+    node->nw = NULL;
+    node->ne = NULL;
+    node->sw = NULL;
+    node->se = NULL;
+    node->devided = false;
+}
+
+static void quadtree_node_remove(Quadtree *quadtree, QuadtreeNode *node, uint32_t id, Box box) {
+    if (!box_overlapp(box, node->area)) {
+        return;
+    }
+
+    if (node->devided) {
+        quadtree_node_remove(quadtree, node->nw, id, box);
+        quadtree_node_remove(quadtree, node->ne, id, box);
+        quadtree_node_remove(quadtree, node->sw, id, box);
+        quadtree_node_remove(quadtree, node->se, id, box);
+        quadtree_node_collapse(quadtree, node);
+        return;
+    }
+
+    for (size_t i = 0; i < node->entry_i; i++) {
+        if (node_entry(node, i)->id == id) {
+            quadtree_node_remove_at(node, i);
+            return;
+        }
+    }
+}
+
+static void quadtree_node_remove_loose(Quadtree *quadtree, QuadtreeNode *node, uint32_t id, Box box) {
+    if (node->devided) {
+        QuadtreeNode *child = quadtree_loose_child(quadtree, node, box);
+        if (child != NULL) {
+            quadtree_node_remove_loose(quadtree, child, id, box);
+            quadtree_node_collapse(quadtree, node);
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < node->entry_i; i++) {
+        if (node_entry(node, i)->id == id) {
+            quadtree_node_remove_at(node, i);
+            break;
+        }
+    }
+    if (node->devided) {
+        quadtree_node_collapse(quadtree, node);
+    }
+}
+
+// Whether both boxes end up in exactly the same set of leaves.
+static bool quadtree_node_same_leaves(const QuadtreeNode *node, Box a, Box b) {
+    bool overlapp = box_overlapp(a, node->area);
+    if (overlapp != box_overlapp(b, node->area)) {
+        return false;
+    }
+    if (!overlapp || !node->devided) {
+        return true;
+    }
+
+    return quadtree_node_same_leaves(node->nw, a, b) &&
+        quadtree_node_same_leaves(node->ne, a, b) &&
+        quadtree_node_same_leaves(node->sw, a, b) &&
+        quadtree_node_same_leaves(node->se, a, b);
+}
+
+static void quadtree_node_refresh(QuadtreeNode *node, uint32_t id, Box box) {
+    if (!box_overlapp(box, node->area)) {
+        return;
+    }
+
+    if (node->devided) {
+        quadtree_node_refresh(node->nw, id, box);
+        quadtree_node_refresh(node->ne, id, box);
+        quadtree_node_refresh(node->sw, id, box);
+        quadtree_node_refresh(node->se, id, box);
+        return;
+    }
+
+    for (size_t i = 0; i < node->entry_i; i++) {
+        if (node_entry(node, i)->id == id) {
+            node_entry(node, i)->box = box;
+            return;
+        }
+    }
+}
+
+void quadtree_remove(Quadtree *quadtree, uint32_t id) {
+    if (!quadtree_contains(quadtree, id)) {
+        return;
+    }
+    quadtree->present[id] = false;
+
+    // Staged boxes have to be in the tree before they can be found.
+    quadtree_build(quadtree);
+    if (quadtree->looseness > 0.0f) {
+        quadtree_node_remove_loose(quadtree, quadtree->root, id, quadtree->boxes[id]);
+    } else {
+        quadtree_node_remove(quadtree, quadtree->root, id, quadtree->boxes[id]);
+    }
+}
+
+void quadtree_update(Quadtree *quadtree, uint32_t id, Box box) {
+    if (!quadtree_contains(quadtree, id)) {
+        return;
+    }
+    quadtree_build(quadtree);
+
+    // Still stored in the same node, only the stored bounds need refreshing.
+    if (quadtree->looseness > 0.0f) {
+        QuadtreeNode *node = quadtree_loose_place(quadtree, quadtree->boxes[id]);
+        if (node == quadtree_loose_place(quadtree, box)) {
+            quadtree->boxes[id] = box;
+            for (size_t i = 0; i < node->entry_i; i++) {
+                if (node_entry(node, i)->id == id) {
+                    node_entry(node, i)->box = box;
+                    break;
+                }
+            }
+            return;
+        }
+    } else if (quadtree_node_same_leaves(quadtree->root, quadtree->boxes[id], box)) {
+        quadtree->boxes[id] = box;
+        quadtree_node_refresh(quadtree->root, id, box);
+        return;
+    }
+
+    quadtree_remove(quadtree, id);
+    quadtree->boxes[id] = box;
+    quadtree->present[id] = true;
+    quadtree_insert_entry(quadtree, (BoxEntry) {
+        .box = box,
+        .id = id,
+    });
+}
+
+void quadtree_clear(Quadtree *quadtree) {
+    vec_clear(quadtree->free_nodes);
+    vec_clear(quadtree->boxes);
+    vec_clear(quadtree->present);
+    vec_clear(quadtree->staged);
+    quadtree->node_pool_i = 0;
+    quadtree->root = quadtree_get_node(quadtree, quadtree->root->area);
+}
+
+// Takes a node from the current chunk of the task, whole chunks are claimed
+// from the pool and only allocated once the pool runs out.
+static QuadtreeNode *quadtree_build_get_node(Quadtree *quadtree, QuadtreeBuild *build, Box area) {
+    if (build->chunk == NULL || build->chunk_i == QUADTREE_NODE_CHUNK_SIZE) {
+        size_t chunk = __atomic_fetch_add(&quadtree->build_chunk_i, 1, __ATOMIC_RELAXED);
+        if (chunk < vec_len(quadtree->node_chunks)) {
+            build->chunk = quadtree->node_chunks[chunk];
+        } else {
+            build->chunk = calloc(QUADTREE_NODE_CHUNK_SIZE, sizeof(QuadtreeNode));
+            vec_push(build->new_chunks, build->chunk);
+        }
+        build->chunk_i = 0;
+    }
+    return quadtree_node_init(&build->chunk[build->chunk_i++], area);
+}
+
+static void quadtree_build_add_task(Quadtree *quadtree, QuadtreeNode *node, const BoxEntry *entries, size_t count, uint32_t depth) {
+    if (quadtree->build_count == vec_len(quadtree->builds)) {
+        vec_push(quadtree->builds, (QuadtreeBuild) {0});
+    }
+    QuadtreeBuild *build = &quadtree->builds[quadtree->build_count++];
+    build->node = node;
+    build->depth = depth;
+    build->chunk = NULL;
+    build->overflow_count = 0;
+    vec_clear(build->new_chunks);
+    vec_clear(build->entries);
+    vec_insert_arr(build->entries, 0, entries, count);
+}
+
+// Children a box is handed to, one bit per child. Loose nodes hand it to at
+// most one child and keep it when none fits.
+static uint32_t quadtree_build_mask(const Quadtree *quadtree, const QuadtreeNode *node, QuadtreeNode *const children[4], Box box) {
+    if (quadtree->looseness > 0.0f) {
+        QuadtreeNode *child = quadtree_loose_child(quadtree, node, box);
+        for (uint32_t c = 0; c < 4; c++) {
+            if (child == children[c]) {
+                return 1u << c;
+            }
+        }
+        return 0;
+    }
+
+    uint32_t mask = 0;
+    for (uint32_t c = 0; c < 4; c++) {
+        mask |= (uint32_t) box_overlapp(box, children[c]->area) << c;
+    }
+    return mask;
+}
+
+// A node is divided exactly when more than 'max_box_count' entries reach it,
+// so building from all entries at once gives the same tree as inserting them
+// one by one.
+static void quadtree_build_node(Quadtree *quadtree, QuadtreeBuild *build, QuadtreeNode *node, size_t begin, size_t end, uint32_t depth, size_t task_size) {
+    const size_t count = end - begin;
+    if (count <= quadtree->max_box_count || depth == quadtree->max_depth-1) {
+        for (size_t i = begin; i < end; i++) {
+            quadtree_node_push(&build->overflow_count, node, build->entries[i]);
+        }
+        return;
+    }
+
+    if (count <= task_size) {
+        quadtree_build_add_task(quadtree, node, &build->entries[begin], count, depth);
+        return;
+    }
+
+    node->nw = quadtree_build_get_node(quadtree, build, quadtree_quadrant(node->area, 0));
+    node->ne = quadtree_build_get_node(quadtree, build, quadtree_quadrant(node->area, 1));
+    node->sw = quadtree_build_get_node(quadtree, build, quadtree_quadrant(node->area, 2));
+    node->se = quadtree_build_get_node(quadtree, build, quadtree_quadrant(node->area, 3));
+    node->devided = true;
+
+    QuadtreeNode *children[4] = {node->nw, node->ne, node->sw, node->se};
+    size_t child_begin[5] = {0};
+    vec_clear(build->masks);
+    vec_insert_arr(build->masks, 0, NULL, count);
+    for (size_t i = begin; i < end; i++) {
+        uint32_t mask = quadtree_build_mask(quadtree, node, children, build->entries[i].box);
+        build->masks[i - begin] = mask;
+        if (mask == 0 && quadtree->looseness > 0.0f) {
+            quadtree_node_push(&build->overflow_count, node, build->entries[i]);
+        }
+        for (size_t c = 0; c < 4; c++) {
+            child_begin[c+1] += mask >> c & 1;
+        }
+    }
+
+    // Entries of the children go after the ones of this node, as one run per
+    // child. Indices stay valid when 'entries' grows.
+    const size_t children_begin = vec_len(build->entries);
+    child_begin[0] = children_begin;
+    for (size_t c = 0; c < 4; c++) {
+        child_begin[c+1] += child_begin[c];
+    }
+    vec_insert_arr(build->entries, children_begin, NULL, child_begin[4] - children_begin);
+
+    size_t cursor[4] = {child_begin[0], child_begin[1], child_begin[2], child_begin[3]};
+    for (size_t i = begin; i < end; i++) {
+        uint32_t mask = build->masks[i - begin];
+        for (size_t c = 0; c < 4; c++) {
+            if (mask >> c & 1) {
+                build->entries[cursor[c]++] = build->entries[i];
+            }
+        }
+    }
+
+    for (size_t c = 0; c < 4; c++) {
+        quadtree_build_node(quadtree, build, children[c], child_begin[c], child_begin[c+1], depth+1, task_size);
+    }
+    vec_remove_arr(build->entries, children_begin, child_begin[4] - children_begin, NULL);
+}
+
+static void quadtree_build_task(void* user_data, uint32_t task, uint32_t thread) {
+    (void) thread;
+    Quadtree *quadtree = user_data;
+    QuadtreeBuild *build = &quadtree->builds[task];
+    quadtree_build_node(quadtree, build, build->node, 0, vec_len(build->entries), build->depth, 0);
+}
+
+static void quadtree_build_finish(Quadtree *quadtree, QuadtreeBuild *build) {
+    if (vec_len(build->new_chunks) > 0) {
+        vec_insert_arr(quadtree->node_chunks, vec_len(quadtree->node_chunks), build->new_chunks, vec_len(build->new_chunks));
+    }
+    quadtree->overflow_count += build->overflow_count;
+}
+
+void quadtree_build(Quadtree *quadtree) {
+    const size_t count = vec_len(quadtree->staged);
+    if (count == 0) {
+        return;
+    }
+
+    // Building top down only works from an empty tree.
+    if (quadtree->root->devided || quadtree->root->entry_i > 0) {
+        for (size_t i = 0; i < count; i++) {
+            quadtree_insert_entry(quadtree, quadtree->staged[i]);
+        }
+        vec_clear(quadtree->staged);
+        return;
+    }
+
+    QuadtreeBuild *top = &quadtree->top_build;
+    top->chunk = NULL;
+    top->overflow_count = 0;
+    vec_clear(top->new_chunks);
+    vec_clear(top->entries);
+    for (size_t i = 0; i < count; i++) {
+        if (quadtree->looseness > 0.0f || box_overlapp(quadtree->staged[i].box, quadtree->root->area)) {
+            vec_push(top->entries, quadtree->staged[i]);
+        }
+    }
+
+    // A few tasks per thread, so uneven subtrees still balance out.
+    size_t task_size = count / (quadtree->thread_pool->thread_count * 4);
+    if (task_size < QUADTREE_BUILD_TASK_MIN) {
+        task_size = QUADTREE_BUILD_TASK_MIN;
+    }
+
+    const size_t first_chunk = (quadtree->node_pool_i + QUADTREE_NODE_CHUNK_SIZE - 1) / QUADTREE_NODE_CHUNK_SIZE;
+    quadtree->build_chunk_i = first_chunk;
+    quadtree->build_count = 0;
+    quadtree_build_node(quadtree, top, quadtree->root, 0, vec_len(top->entries), 0, task_size);
+    thread_pool_run(quadtree->thread_pool, quadtree_build_task, quadtree, quadtree->build_count);
+
+    quadtree_build_finish(quadtree, top);
+    for (size_t i = 0; i < quadtree->build_count; i++) {
+        quadtree_build_finish(quadtree, &quadtree->builds[i]);
+    }
+    // Every claimed chunk counts as used, chunks past the old pool were
+    // allocated one per claim.
+    if (quadtree->build_chunk_i > first_chunk) {
+        quadtree->node_pool_i = quadtree->build_chunk_i * QUADTREE_NODE_CHUNK_SIZE;
+    }
+    vec_clear(quadtree->staged);
 }
 
-void quadtree_query_helper(const QuadtreeNode *node, Box area, Vec(Box) *result) {
-    if (node == NULL || !box_overlapp(node->area, area)) {
+static void quadtree_query_helper(const Quadtree *quadtree, const QuadtreeNode *node, Box area, Vec(uint32_t) *result) {
+    for (size_t i = 0; i < node->entry_i; i++) {
+        vec_push(*result, node_entry(node, i)->id);
+    }
+
+    if (!node->devided) {
         return;
     }
 
-    quadtree_query_helper(node->nw, area, result);
-    quadtree_query_helper(node->ne, area, result);
-    quadtree_query_helper(node->sw, area, result);
-    quadtree_query_helper(node->se, area, result);
+    const QuadtreeNode *children[4] = {node->nw, node->ne, node->sw, node->se};
+    for (uint32_t i = 0; i < 4; i++) {
+        if (box_overlapp(quadtree_node_bounds(quadtree, children[i]), area)) {
+            quadtree_query_helper(quadtree, children[i], area, result);
+        }
+    }
+}
 
-    vec_insert_arr(*result, vec_len(*result), node->boxes, node->box_i);
+// The root is always visited, a loose root also holds the boxes reaching
+// outside of its bounds.
+void quadtree_query_into(const Quadtree* quadtree, Box area, Vec(uint32_t)* result) {
+    quadtree_query_helper(quadtree, quadtree->root, area, result);
 }
 
-Vec(Box) quadtree_query(const Quadtree* quadtree, Box area) {
-    Vec(Box) result = NULL;
-    quadtree_query_helper(&quadtree->node_pool[0], area, &result);
+Vec(uint32_t) quadtree_query(const Quadtree* quadtree, Box area) {
+    Vec(uint32_t) result = NULL;
+    quadtree_query_into(quadtree, area, &result);
     return result;
 }
 
+static bool quadtree_query_visit_helper(const Quadtree *quadtree, const QuadtreeNode *node, Box area, BoxVisitFunc func, void* user_data) {
+    for (size_t i = 0; i < node->entry_i; i++) {
+        const BoxEntry *entry = node_entry(node, i);
+        if (func(user_data, entry->id, entry->box)) {
+            return true;
+        }
+    }
+
+    if (!node->devided) {
+        return false;
+    }
+
+    const QuadtreeNode *children[4] = {node->nw, node->ne, node->sw, node->se};
+    for (uint32_t i = 0; i < 4; i++) {
+        if (box_overlapp(quadtree_node_bounds(quadtree, children[i]), area) &&
+            quadtree_query_visit_helper(quadtree, children[i], area, func, user_data)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool quadtree_query_visit(const Quadtree* quadtree, Box area, BoxVisitFunc func, void* user_data) {
+    return quadtree_query_visit_helper(quadtree, quadtree->root, area, func, user_data);
+}
+
+static void quadtree_find_pairs_helper(const Quadtree *quadtree, const QuadtreeNode *node, Vec(BoxPair)* pairs) {
+    if (node == NULL) {
+        return;
+    }
+
+    if (node->devided) {
+        quadtree_find_pairs_helper(quadtree, node->nw, pairs);
+        quadtree_find_pairs_helper(quadtree, node->ne, pairs);
+        quadtree_find_pairs_helper(quadtree, node->sw, pairs);
+        quadtree_find_pairs_helper(quadtree, node->se, pairs);
+        return;
+    }
+
+    const Box root = quadtree->root->area;
+
+    for (size_t i = 0; i < node->entry_i; i++) {
+        const BoxEntry *a = node_entry(node, i);
+        for (size_t j = i+1; j < node->entry_i; j++) {
+            const BoxEntry *b = node_entry(node, j);
+            if (!box_overlapp(a->box, b->box)) {
+                continue;
+            }
+
+            // Boxes are stored in every leaf they touch, so only the leaf
+            // owning the overlap's corner reports the pair. Both boxes reach
+            // into the root, so their overlap does too and the corner is
+            // clamped into it.
+            Vec2 corner = box_overlapp_min(a->box, b->box);
+            corner = vec2(fmaxf(corner.x, root.pos.x), fmaxf(corner.y, root.pos.y));
+            if (!box_contains_point(node->area, corner)) {
+                continue;
+            }
+
+            vec_push(*pairs, box_pair(a->id, b->id));
+        }
+    }
+}
+
+// Pair 'entry' with everything overlapping it in the subtree of a loose node.
+static void quadtree_pair_subtree_loose(const Quadtree *quadtree, const QuadtreeNode *node, const BoxEntry *entry, Vec(BoxPair)* pairs) {
+    for (size_t i = 0; i < node->entry_i; i++) {
+        if (box_overlapp(entry->box, node_entry(node, i)->box)) {
+            vec_push(*pairs, box_pair(entry->id, node_entry(node, i)->id));
+        }
+    }
+
+    if (!node->devided) {
+        return;
+    }
+
+    const QuadtreeNode *children[4] = {node->nw, node->ne, node->sw, node->se};
+    for (uint32_t i = 0; i < 4; i++) {
+        if (box_overlapp(quadtree_node_bounds(quadtree, children[i]), entry->box)) {
+            quadtree_pair_subtree_loose(quadtree, children[i], entry, pairs);
+        }
+    }
+}
+
+// Pair the entries of 'node' with everything in the subtrees of the
+// children of 'other'.
+static void quadtree_pair_entries_loose(const Quadtree *quadtree, const QuadtreeNode *node, const QuadtreeNode *other, Vec(BoxPair)* pairs) {
+    if (!other->devided) {
+        return;
+    }
+
+    const QuadtreeNode *children[4] = {other->nw, other->ne, other->sw, other->se};
+    for (size_t i = 0; i < node->entry_i; i++) {
+        for (uint32_t c = 0; c < 4; c++) {
+            if (box_overlapp(quadtree_node_bounds(quadtree, children[c]), node_entry(node, i)->box)) {
+                quadtree_pair_subtree_loose(quadtree, children[c], node_entry(node, i), pairs);
+            }
+        }
+    }
+}
+
+// Every pair with one box in the subtree of 'a' and the other in the subtree
+// of 'b', for two disjoint subtrees.
+static void quadtree_pair_nodes_loose(const Quadtree *quadtree, const QuadtreeNode *a, const QuadtreeNode *b, Vec(BoxPair)* pairs) {
+    if (!box_overlapp(quadtree_node_bounds(quadtree, a), quadtree_node_bounds(quadtree, b))) {
+        return;
+    }
+
+    for (size_t i = 0; i < a->entry_i; i++) {
+        for (size_t j = 0; j < b->entry_i; j++) {
+            if (box_overlapp(node_entry(a, i)->box, node_entry(b, j)->box)) {
+                vec_push(*pairs, box_pair(node_entry(a, i)->id, node_entry(b, j)->id));
+            }
+        }
+    }
+
+    quadtree_pair_entries_loose(quadtree, a, b, pairs);
+    quadtree_pair_entries_loose(quadtree, b, a, pairs);
+
+    if (!a->devided || !b->devided) {
+        return;
+    }
+
+    const QuadtreeNode *a_children[4] = {a->nw, a->ne, a->sw, a->se};
+    const QuadtreeNode *b_children[4] = {b->nw, b->ne, b->sw, b->se};
+    for (uint32_t i = 0; i < 4; i++) {
+        for (uint32_t j = 0; j < 4; j++) {
+            quadtree_pair_nodes_loose(quadtree, a_children[i], b_children[j], pairs);
+        }
+    }
+}
+
+// Every box of a loose tree is stored once, but the bounds of siblings
+// overlap, so besides pairing a node's entries with each other and with its
+// subtree, every two sibling subtrees have to be paired as well.
+static void quadtree_find_pairs_loose_helper(const Quadtree *quadtree, const QuadtreeNode *node, Vec(BoxPair)* pairs) {
+    for (size_t i = 0; i < node->entry_i; i++) {
+        const BoxEntry *a = node_entry(node, i);
+        for (size_t j = i+1; j < node->entry_i; j++) {
+            if (box_overlapp(a->box, node_entry(node, j)->box)) {
+                vec_push(*pairs, box_pair(a->id, node_entry(node, j)->id));
+            }
+        }
+    }
+    quadtree_pair_entries_loose(quadtree, node, node, pairs);
+
+    if (!node->devided) {
+        return;
+    }
+
+    const QuadtreeNode *children[4] = {node->nw, node->ne, node->sw, node->se};
+    for (uint32_t i = 0; i < 4; i++) {
+        for (uint32_t j = i+1; j < 4; j++) {
+            quadtree_pair_nodes_loose(quadtree, children[i], children[j], pairs);
+        }
+        quadtree_find_pairs_loose_helper(quadtree, children[i], pairs);
+    }
+}
+
+void quadtree_find_pairs(const Quadtree* quadtree, Vec(BoxPair)* pairs) {
+    if (quadtree->looseness > 0.0f) {
+        quadtree_find_pairs_loose_helper(quadtree, quadtree->root, pairs);
+        return;
+    }
+    quadtree_find_pairs_helper(quadtree, quadtree->root, pairs);
+}
+
 void quadtree_debug_draw_helper(const QuadtreeNode *node, SDL_Renderer *renderer) {
     if (node == NULL) {
         return;
@@ -170,5 +862,5 @@ void quadtree_debug_draw_helper(const QuadtreeNode *node, SDL_Renderer *renderer
 }
 
 void quadtree_debug_draw(const Quadtree* quadtree, SDL_Renderer *renderer) {
-    quadtree_debug_draw_helper(&quadtree->node_pool[0], renderer);
+    quadtree_debug_draw_helper(quadtree->root, renderer);
 }
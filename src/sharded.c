@@ -0,0 +1,321 @@
+#include "sharded.h"
+#include "strategy_interface.h"
+#include "ds.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static uint32_t sharded_tile_count(const Sharded* sharded) {
+    return sharded->column_count * sharded->row_count;
+}
+
+static uint32_t sharded_bin(float value, float min, float size) {
+    float bin = (value - min) / size * SHARDED_DENSITY_BINS;
+    if (!(bin > 0.0f)) {
+        return 0;
+    }
+    if (bin >= SHARDED_DENSITY_BINS) {
+        return SHARDED_DENSITY_BINS - 1;
+    }
+    return bin;
+}
+
+// Cuts '[min, min + size)' into 'parts' ranges holding about the same share
+// of the histogram, the outer borders are infinite.
+static void sharded_split(const uint32_t *histogram, float min, float size, uint32_t parts, float *bounds) {
+    size_t total = 0;
+    for (uint32_t bin = 0; bin < SHARDED_DENSITY_BINS; bin++) {
+        total += histogram[bin];
+    }
+
+    bounds[0] = -INFINITY;
+    bounds[parts] = INFINITY;
+    if (total == 0) {
+        for (uint32_t part = 1; part < parts; part++) {
+            bounds[part] = min + size * part / parts;
+        }
+        return;
+    }
+
+    uint32_t part = 1;
+    size_t sum = 0;
+    for (uint32_t bin = 0; bin < SHARDED_DENSITY_BINS; bin++) {
+        sum += histogram[bin];
+        // Cut after the bin filling this part up to its share.
+        while (part < parts && sum * parts >= total * part) {
+            bounds[part++] = min + size * (bin + 1) / SHARDED_DENSITY_BINS;
+        }
+    }
+}
+
+// Range 'i' with 'bounds[i] <= value < bounds[i+1]'.
+static uint32_t sharded_find(const float *bounds, uint32_t count, float value) {
+    uint32_t low = 0;
+    uint32_t high = count;
+    while (high - low > 1) {
+        uint32_t mid = (low + high) / 2;
+        if (value >= bounds[mid]) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Ranges overlapped by '[min, max)'. Always at least one, so boxes without
+// an area still land in a tile.
+static void sharded_range(const float *bounds, uint32_t count, float min, float max, uint32_t *first, uint32_t *end) {
+    *first = sharded_find(bounds, count, min);
+    *end = *first + 1;
+    while (*end < count && bounds[*end] < max) {
+        (*end)++;
+    }
+}
+
+static bool sharded_tile_contains(const ShardedTile *tile, Vec2 point) {
+    return point.x >= tile->min.x && point.x < tile->max.x &&
+        point.y >= tile->min.y && point.y < tile->max.y;
+}
+
+// Runs 'func' once for every tile.
+static void sharded_run(const Sharded* sharded, ThreadPoolTaskFunc func, void* user_data) {
+    if (sharded->thread_pool != NULL) {
+        thread_pool_run(sharded->thread_pool, func, user_data, sharded_tile_count(sharded));
+        return;
+    }
+    for (uint32_t tile = 0; tile < sharded_tile_count(sharded); tile++) {
+        func(user_data, tile, 0);
+    }
+}
+
+// Balances the columns over all box centers and the rows of every column
+// over the centers within it.
+static void sharded_layout(Sharded *sharded) {
+    const Box area = sharded->area;
+    const size_t count = vec_len(sharded->entries);
+
+    memset(sharded->histograms, 0, SHARDED_DENSITY_BINS * sizeof(uint32_t));
+    for (size_t i = 0; i < count; i++) {
+        const Box box = sharded->entries[i].box;
+        sharded->histograms[sharded_bin(box.pos.x + box.size.x/2.0f, area.pos.x, area.size.x)]++;
+    }
+    sharded_split(sharded->histograms, area.pos.x, area.size.x, sharded->column_count, sharded->column_x);
+
+    memset(sharded->histograms, 0, sharded->column_count * SHARDED_DENSITY_BINS * sizeof(uint32_t));
+    for (size_t i = 0; i < count; i++) {
+        const Box box = sharded->entries[i].box;
+        uint32_t column = sharded_find(sharded->column_x, sharded->column_count, box.pos.x + box.size.x/2.0f);
+        sharded->histograms[column*SHARDED_DENSITY_BINS + sharded_bin(box.pos.y + box.size.y/2.0f, area.pos.y, area.size.y)]++;
+    }
+
+    for (uint32_t column = 0; column < sharded->column_count; column++) {
+        float *row_y = &sharded->row_y[column * (sharded->row_count + 1)];
+        sharded_split(&sharded->histograms[column*SHARDED_DENSITY_BINS], area.pos.y, area.size.y, sharded->row_count, row_y);
+
+        for (uint32_t row = 0; row < sharded->row_count; row++) {
+            ShardedTile *tile = &sharded->tiles[column*sharded->row_count + row];
+            tile->min = vec2(sharded->column_x[column], row_y[row]);
+            tile->max = vec2(sharded->column_x[column + 1], row_y[row + 1]);
+        }
+    }
+}
+
+Sharded* sharded_new(const ShardedDesc* desc) {
+    Sharded* sharded = malloc(sizeof(Sharded));
+    *sharded = (Sharded) {
+        .strategy = desc->strategy,
+        .area = desc->area,
+        .column_count = desc->column_count > 0 ? desc->column_count : 1,
+        .row_count = desc->row_count > 0 ? desc->row_count : 1,
+        .thread_pool = desc->thread_pool,
+    };
+
+    sharded->tiles = calloc(sharded_tile_count(sharded), sizeof(ShardedTile));
+    for (uint32_t tile = 0; tile < sharded_tile_count(sharded); tile++) {
+        sharded->tiles[tile].data = desc->strategy->new(desc->desc);
+    }
+    sharded->column_x = malloc((sharded->column_count + 1) * sizeof(float));
+    sharded->row_y = malloc(sharded->column_count * (sharded->row_count + 1) * sizeof(float));
+    sharded->histograms = malloc(sharded->column_count * SHARDED_DENSITY_BINS * sizeof(uint32_t));
+
+    // Evenly spaced until the first build.
+    sharded_layout(sharded);
+
+    return sharded;
+}
+
+void sharded_free(Sharded *sharded) {
+    for (uint32_t tile = 0; tile < sharded_tile_count(sharded); tile++) {
+        sharded->strategy->free(sharded->tiles[tile].data);
+        vec_free(sharded->tiles[tile].entries);
+    }
+    free(sharded->tiles);
+    free(sharded->column_x);
+    free(sharded->row_y);
+    free(sharded->histograms);
+    vec_free(sharded->entries);
+    vec_free(sharded->boxes);
+    free(sharded);
+}
+
+void sharded_insert(Sharded *sharded, uint32_t id, Box box) {
+    if (id >= vec_len(sharded->boxes)) {
+        vec_insert_arr(sharded->boxes, vec_len(sharded->boxes), NULL, id+1 - vec_len(sharded->boxes));
+    }
+    sharded->boxes[id] = box;
+
+    vec_push(sharded->entries, ((BoxEntry) {
+        .box = box,
+        .id = id,
+    }));
+}
+
+void sharded_clear(Sharded *sharded) {
+    vec_clear(sharded->entries);
+    vec_clear(sharded->boxes);
+    for (uint32_t tile = 0; tile < sharded_tile_count(sharded); tile++) {
+        sharded->strategy->clear(sharded->tiles[tile].data);
+        vec_clear(sharded->tiles[tile].entries);
+    }
+}
+
+static void sharded_build_task(void* user_data, uint32_t task, uint32_t thread) {
+    (void) thread;
+    const Sharded *sharded = user_data;
+    ShardedTile *tile = &sharded->tiles[task];
+
+    sharded->strategy->clear(tile->data);
+    for (size_t i = 0; i < vec_len(tile->entries); i++) {
+        sharded->strategy->insert(tile->data, tile->entries[i].id, tile->entries[i].box);
+    }
+    if (sharded->strategy->build != NULL) {
+        sharded->strategy->build(tile->data);
+    }
+}
+
+void sharded_build(Sharded *sharded) {
+    sharded_layout(sharded);
+
+    // Every box goes to all tiles it overlaps, the ones past the first are
+    // its halo.
+    size_t copies = 0;
+    for (uint32_t tile = 0; tile < sharded_tile_count(sharded); tile++) {
+        vec_clear(sharded->tiles[tile].entries);
+    }
+    for (size_t i = 0; i < vec_len(sharded->entries); i++) {
+        const BoxEntry entry = sharded->entries[i];
+        uint32_t first_column, end_column;
+        sharded_range(sharded->column_x, sharded->column_count, entry.box.pos.x, entry.box.pos.x + entry.box.size.x, &first_column, &end_column);
+        for (uint32_t column = first_column; column < end_column; column++) {
+            uint32_t first_row, end_row;
+            sharded_range(&sharded->row_y[column * (sharded->row_count + 1)], sharded->row_count, entry.box.pos.y, entry.box.pos.y + entry.box.size.y, &first_row, &end_row);
+            for (uint32_t row = first_row; row < end_row; row++) {
+                vec_push(sharded->tiles[column*sharded->row_count + row].entries, entry);
+                copies++;
+            }
+        }
+    }
+    sharded->halo_count = copies - vec_len(sharded->entries);
+
+    sharded_run(sharded, sharded_build_task, sharded);
+}
+
+void sharded_query_into(const Sharded* sharded, Box area, Vec(uint32_t)* result) {
+    uint32_t first_column, end_column;
+    sharded_range(sharded->column_x, sharded->column_count, area.pos.x, area.pos.x + area.size.x, &first_column, &end_column);
+    for (uint32_t column = first_column; column < end_column; column++) {
+        uint32_t first_row, end_row;
+        sharded_range(&sharded->row_y[column * (sharded->row_count + 1)], sharded->row_count, area.pos.y, area.pos.y + area.size.y, &first_row, &end_row);
+        for (uint32_t row = first_row; row < end_row; row++) {
+            sharded->strategy->query_into(sharded->tiles[column*sharded->row_count + row].data, area, result);
+        }
+    }
+}
+
+Vec(uint32_t) sharded_query(const Sharded* sharded, Box area) {
+    Vec(uint32_t) result = NULL;
+    sharded_query_into(sharded, area, &result);
+    return result;
+}
+
+bool sharded_query_visit(const Sharded* sharded, Box area, BoxVisitFunc func, void* user_data) {
+    uint32_t first_column, end_column;
+    sharded_range(sharded->column_x, sharded->column_count, area.pos.x, area.pos.x + area.size.x, &first_column, &end_column);
+    for (uint32_t column = first_column; column < end_column; column++) {
+        uint32_t first_row, end_row;
+        sharded_range(&sharded->row_y[column * (sharded->row_count + 1)], sharded->row_count, area.pos.y, area.pos.y + area.size.y, &first_row, &end_row);
+        for (uint32_t row = first_row; row < end_row; row++) {
+            if (sharded->strategy->visit(sharded->tiles[column*sharded->row_count + row].data, area, func, user_data)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Pair buffers of one 'find_pairs' call, one per tile.
+typedef struct ShardedPairs ShardedPairs;
+struct ShardedPairs {
+    const Sharded* sharded;
+    Vec(BoxPair)* tile_pairs;
+};
+
+// Both boxes of a pair overlap the tile holding the corner of their overlap,
+// so exactly one tile finds and keeps it.
+static void sharded_pairs_task(void* user_data, uint32_t task, uint32_t thread) {
+    (void) thread;
+    const ShardedPairs *job = user_data;
+    const Sharded *sharded = job->sharded;
+    const ShardedTile *tile = &sharded->tiles[task];
+    Vec(BoxPair)* pairs = &job->tile_pairs[task];
+
+    sharded->strategy->find_pairs(tile->data, pairs);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < vec_len(*pairs); i++) {
+        const BoxPair pair = (*pairs)[i];
+        if (sharded_tile_contains(tile, box_overlapp_min(sharded->boxes[pair.a], sharded->boxes[pair.b]))) {
+            (*pairs)[kept++] = pair;
+        }
+    }
+    if (kept < vec_len(*pairs)) {
+        vec_remove_arr(*pairs, kept, vec_len(*pairs) - kept, NULL);
+    }
+}
+
+void sharded_find_pairs(const Sharded* sharded, Vec(BoxPair)* pairs) {
+    ShardedPairs job = {
+        .sharded = sharded,
+        .tile_pairs = calloc(sharded_tile_count(sharded), sizeof(Vec(BoxPair))),
+    };
+    sharded_run(sharded, sharded_pairs_task, &job);
+
+    for (uint32_t tile = 0; tile < sharded_tile_count(sharded); tile++) {
+        Vec(BoxPair) tile_pairs = job.tile_pairs[tile];
+        if (vec_len(tile_pairs) > 0) {
+            vec_insert_arr(*pairs, vec_len(*pairs), tile_pairs, vec_len(tile_pairs));
+        }
+        vec_free(tile_pairs);
+    }
+    free(job.tile_pairs);
+}
+
+void sharded_debug_draw(const Sharded* sharded, SDL_Renderer *renderer) {
+    const Vec2 area_min = sharded->area.pos;
+    const Vec2 area_max = vec2_add(sharded->area.pos, sharded->area.size);
+    for (uint32_t tile = 0; tile < sharded_tile_count(sharded); tile++) {
+        const ShardedTile *shard = &sharded->tiles[tile];
+        // The border tiles reach out forever, draw them up to the area.
+        Vec2 min = vec2(fmaxf(shard->min.x, area_min.x), fmaxf(shard->min.y, area_min.y));
+        Vec2 max = vec2(fminf(shard->max.x, area_max.x), fminf(shard->max.y, area_max.y));
+        SDL_FRect rect = {
+            .x = min.x,
+            .y = min.y,
+            .w = max.x - min.x,
+            .h = max.y - min.y,
+        };
+        SDL_RenderDrawRectF(renderer, &rect);
+    }
+}
@@ -0,0 +1,432 @@
+#include "sorted_hash.h"
+#include "cell_range.h"
+#include "ds.h"
+
+#include <SDL2/SDL_render.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static CellRange sorted_hash_cell_range(const SortedSpatialHash* space, Box box) {
+    return cell_range(box, vec2s(0.0f), space->cell_size);
+}
+
+static const SortedCell *sorted_hash_lookup(const SortedSpatialHash* space, uint64_t key) {
+    const uint32_t mask = space->cell_capacity - 1;
+    uint32_t index = cell_hash(key) & mask;
+    while (space->cells[index].count != 0) {
+        if (space->cells[index].key == key) {
+            return &space->cells[index];
+        }
+        index = (index + 1) & mask;
+    }
+    return NULL;
+}
+
+// LSD radix sort on 8 bit digits, ping-ponging between 'items' and
+// 'items_back'. Digits shared by every key, like the high bits of nearby
+// cells, are skipped.
+static void sorted_hash_radix_sort(SortedSpatialHash *space, uint32_t count) {
+    for (uint32_t shift = 0; shift < 64; shift += 8) {
+        uint32_t histogram[256] = {0};
+        for (uint32_t i = 0; i < count; i++) {
+            histogram[(space->items[i].key >> shift) & 0xff]++;
+        }
+        if (histogram[(space->items[0].key >> shift) & 0xff] == count) {
+            continue;
+        }
+
+        uint32_t offset = 0;
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t digit_count = histogram[i];
+            histogram[i] = offset;
+            offset += digit_count;
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            SortItem item = space->items[i];
+            space->items_back[histogram[(item.key >> shift) & 0xff]++] = item;
+        }
+
+        SortItem *temp = space->items;
+        space->items = space->items_back;
+        space->items_back = temp;
+    }
+}
+
+SortedSpatialHash* sorted_hash_new(const SpatialHashDesc* desc) {
+    uint32_t cell_capacity = 1;
+    while (cell_capacity < desc->map_capacity) {
+        cell_capacity <<= 1;
+    }
+
+    SortedSpatialHash* space = malloc(sizeof(SortedSpatialHash));
+    *space = (SortedSpatialHash) {
+        .cell_size = desc->cell_size,
+        .cells = calloc(cell_capacity, sizeof(SortedCell)),
+        .cell_capacity = cell_capacity,
+        .thread_pool = desc->thread_pool,
+    };
+    if (space->thread_pool != NULL) {
+        space->slice_histograms = malloc(space->thread_pool->thread_count * 256 * sizeof(uint32_t));
+        space->slice_offsets = malloc(space->thread_pool->thread_count * sizeof(uint32_t));
+    }
+    return space;
+}
+
+void sorted_hash_free(SortedSpatialHash *space) {
+    vec_free(space->staged);
+    free(space->items);
+    free(space->items_back);
+    free(space->entries);
+    free(space->cells);
+    free(space->slice_histograms);
+    free(space->slice_offsets);
+    free(space);
+}
+
+void sorted_hash_insert(SortedSpatialHash *space, uint32_t id, Box box) {
+    BoxEntry entry = {
+        .box = box,
+        .id = id,
+    };
+    vec_push(space->staged, entry);
+}
+
+static void sorted_hash_reserve(SortedSpatialHash *space, uint32_t count) {
+    if (count > space->entry_capacity) {
+        space->entry_capacity = count*2;
+        free(space->items);
+        free(space->items_back);
+        free(space->entries);
+        space->items = malloc(space->entry_capacity * sizeof(SortItem));
+        space->items_back = malloc(space->entry_capacity * sizeof(SortItem));
+        space->entries = malloc(space->entry_capacity * sizeof(BoxEntry));
+    }
+    space->entry_count = count;
+}
+
+static uint32_t sorted_hash_cell_count(const SortedSpatialHash* space, uint32_t begin, uint32_t end) {
+    uint32_t count = 0;
+    for (uint32_t i = begin; i < end; i++) {
+        CellRange range = sorted_hash_cell_range(space, space->staged[i].box);
+        count += (range.max_x - range.min_x) * (range.max_y - range.min_y);
+    }
+    return count;
+}
+
+// Emits a (cell key, entry) pair for every cell covered by the staged entries
+// '[begin, end)', starting at 'items[item_i]'.
+static void sorted_hash_emit(SortedSpatialHash *space, uint32_t begin, uint32_t end, uint32_t item_i) {
+    for (uint32_t i = begin; i < end; i++) {
+        CellRange range = sorted_hash_cell_range(space, space->staged[i].box);
+        for (int32_t y = range.min_y; y < range.max_y; y++) {
+            for (int32_t x = range.min_x; x < range.max_x; x++) {
+                space->items[item_i++] = (SortItem) {
+                    .key = cell_key(x, y),
+                    .index = i,
+                };
+            }
+        }
+    }
+}
+
+static void sorted_hash_index_runs(SortedSpatialHash *space, uint32_t count) {
+    uint32_t run_count = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (i == 0 || space->items[i].key != space->items[i-1].key) {
+            run_count++;
+        }
+    }
+
+    // Grows to fit the runs and shrinks once it's four times larger than
+    // needed, so clearing it stays proportional to the runs.
+    uint32_t cell_capacity = 1;
+    while (cell_capacity < run_count*2) {
+        cell_capacity <<= 1;
+    }
+    if (cell_capacity > space->cell_capacity || cell_capacity*4 <= space->cell_capacity) {
+        free(space->cells);
+        space->cells = malloc(cell_capacity * sizeof(SortedCell));
+        space->cell_capacity = cell_capacity;
+    }
+    memset(space->cells, 0, space->cell_capacity * sizeof(SortedCell));
+
+    const uint32_t mask = space->cell_capacity - 1;
+    uint32_t start = 0;
+    for (uint32_t i = 1; i <= count; i++) {
+        if (i < count && space->items[i].key == space->items[start].key) {
+            continue;
+        }
+
+        uint64_t key = space->items[start].key;
+        uint32_t index = cell_hash(key) & mask;
+        while (space->cells[index].count != 0) {
+            index = (index + 1) & mask;
+        }
+        space->cells[index] = (SortedCell) {
+            .key = key,
+            .start = start,
+            .count = i - start,
+        };
+        start = i;
+    }
+}
+
+// State shared by the tasks of a parallel build. Every task works on one
+// slice of either the staged entries or the items.
+typedef struct SortTask SortTask;
+struct SortTask {
+    SortedSpatialHash *space;
+    uint32_t count;
+    uint32_t shift;
+};
+
+static void sort_task_slice(const SortTask *task, uint32_t count, uint32_t slice, uint32_t *begin, uint32_t *end) {
+    const uint32_t slice_count = task->space->thread_pool->thread_count;
+    *begin = (uint64_t) count * slice / slice_count;
+    *end = (uint64_t) count * (slice + 1) / slice_count;
+}
+
+static void sorted_hash_count_task(void* user_data, uint32_t slice, uint32_t thread) {
+    (void) thread;
+    const SortTask *task = user_data;
+    uint32_t begin, end;
+    sort_task_slice(task, vec_len(task->space->staged), slice, &begin, &end);
+    task->space->slice_offsets[slice] = sorted_hash_cell_count(task->space, begin, end);
+}
+
+static void sorted_hash_emit_task(void* user_data, uint32_t slice, uint32_t thread) {
+    (void) thread;
+    const SortTask *task = user_data;
+    uint32_t begin, end;
+    sort_task_slice(task, vec_len(task->space->staged), slice, &begin, &end);
+    sorted_hash_emit(task->space, begin, end, task->space->slice_offsets[slice]);
+}
+
+static void sorted_hash_histogram_task(void* user_data, uint32_t slice, uint32_t thread) {
+    (void) thread;
+    const SortTask *task = user_data;
+    const SortItem *items = task->space->items;
+    uint32_t *histogram = task->space->slice_histograms + slice*256;
+
+    memset(histogram, 0, 256 * sizeof(uint32_t));
+    uint32_t begin, end;
+    sort_task_slice(task, task->count, slice, &begin, &end);
+    for (uint32_t i = begin; i < end; i++) {
+        histogram[(items[i].key >> task->shift) & 0xff]++;
+    }
+}
+
+static void sorted_hash_scatter_task(void* user_data, uint32_t slice, uint32_t thread) {
+    (void) thread;
+    const SortTask *task = user_data;
+    const SortItem *items = task->space->items;
+    SortItem *items_back = task->space->items_back;
+    uint32_t *cursors = task->space->slice_histograms + slice*256;
+
+    uint32_t begin, end;
+    sort_task_slice(task, task->count, slice, &begin, &end);
+    for (uint32_t i = begin; i < end; i++) {
+        items_back[cursors[(items[i].key >> task->shift) & 0xff]++] = items[i];
+    }
+}
+
+static void sorted_hash_gather_task(void* user_data, uint32_t slice, uint32_t thread) {
+    (void) thread;
+    const SortTask *task = user_data;
+    SortedSpatialHash *space = task->space;
+    uint32_t begin, end;
+    sort_task_slice(task, task->count, slice, &begin, &end);
+    for (uint32_t i = begin; i < end; i++) {
+        space->entries[i] = space->staged[space->items[i].index];
+    }
+}
+
+// Same passes as 'sorted_hash_radix_sort'. Digits are laid out slice by slice,
+// so equal digits keep their order and the sort stays stable.
+static void sorted_hash_radix_sort_parallel(SortedSpatialHash *space, uint32_t count) {
+    ThreadPool *pool = space->thread_pool;
+    SortTask task = {
+        .space = space,
+        .count = count,
+    };
+
+    for (task.shift = 0; task.shift < 64; task.shift += 8) {
+        thread_pool_run(pool, sorted_hash_histogram_task, &task, pool->thread_count);
+
+        uint32_t first_digit = (space->items[0].key >> task.shift) & 0xff;
+        uint32_t first_digit_count = 0;
+        for (uint32_t slice = 0; slice < pool->thread_count; slice++) {
+            first_digit_count += space->slice_histograms[slice*256 + first_digit];
+        }
+        if (first_digit_count == count) {
+            continue;
+        }
+
+        uint32_t offset = 0;
+        for (uint32_t digit = 0; digit < 256; digit++) {
+            for (uint32_t slice = 0; slice < pool->thread_count; slice++) {
+                uint32_t *histogram = space->slice_histograms + slice*256;
+                uint32_t digit_count = histogram[digit];
+                histogram[digit] = offset;
+                offset += digit_count;
+            }
+        }
+
+        thread_pool_run(pool, sorted_hash_scatter_task, &task, pool->thread_count);
+
+        SortItem *temp = space->items;
+        space->items = space->items_back;
+        space->items_back = temp;
+    }
+}
+
+static void sorted_hash_build_parallel(SortedSpatialHash *space) {
+    ThreadPool *pool = space->thread_pool;
+    SortTask task = {
+        .space = space,
+    };
+
+    thread_pool_run(pool, sorted_hash_count_task, &task, pool->thread_count);
+    uint32_t count = 0;
+    for (uint32_t slice = 0; slice < pool->thread_count; slice++) {
+        uint32_t slice_count = space->slice_offsets[slice];
+        space->slice_offsets[slice] = count;
+        count += slice_count;
+    }
+    sorted_hash_reserve(space, count);
+    thread_pool_run(pool, sorted_hash_emit_task, &task, pool->thread_count);
+
+    if (count > 0) {
+        sorted_hash_radix_sort_parallel(space, count);
+    }
+
+    task.count = count;
+    thread_pool_run(pool, sorted_hash_gather_task, &task, pool->thread_count);
+    sorted_hash_index_runs(space, count);
+}
+
+void sorted_hash_build(SortedSpatialHash *space) {
+    if (space->thread_pool != NULL) {
+        sorted_hash_build_parallel(space);
+        return;
+    }
+
+    const uint32_t count = sorted_hash_cell_count(space, 0, vec_len(space->staged));
+    sorted_hash_reserve(space, count);
+    sorted_hash_emit(space, 0, vec_len(space->staged), 0);
+
+    if (count > 0) {
+        sorted_hash_radix_sort(space, count);
+    }
+
+    // Gather the entries in key order.
+    for (uint32_t i = 0; i < count; i++) {
+        space->entries[i] = space->staged[space->items[i].index];
+    }
+    sorted_hash_index_runs(space, count);
+}
+
+void sorted_hash_clear(SortedSpatialHash *space) {
+    vec_clear(space->staged);
+    // Empty until the next build, the buffers are left allocated.
+    memset(space->cells, 0, space->cell_capacity * sizeof(SortedCell));
+    space->entry_count = 0;
+}
+
+void sorted_hash_query_into(const SortedSpatialHash* space, Box area, Vec(uint32_t)* result) {
+    CellRange range = sorted_hash_cell_range(space, area);
+    for (int32_t y = range.min_y; y < range.max_y; y++) {
+        for (int32_t x = range.min_x; x < range.max_x; x++) {
+            const SortedCell *cell = sorted_hash_lookup(space, cell_key(x, y));
+            if (cell == NULL) {
+                continue;
+            }
+            for (uint32_t i = cell->start; i < cell->start + cell->count; i++) {
+                vec_push(*result, space->entries[i].id);
+            }
+        }
+    }
+}
+
+bool sorted_hash_query_visit(const SortedSpatialHash* space, Box area, BoxVisitFunc func, void* user_data) {
+    CellRange range = sorted_hash_cell_range(space, area);
+    for (int32_t y = range.min_y; y < range.max_y; y++) {
+        for (int32_t x = range.min_x; x < range.max_x; x++) {
+            const SortedCell *cell = sorted_hash_lookup(space, cell_key(x, y));
+            if (cell == NULL) {
+                continue;
+            }
+            for (uint32_t i = cell->start; i < cell->start + cell->count; i++) {
+                if (func(user_data, space->entries[i].id, space->entries[i].box)) {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+Vec(uint32_t) sorted_hash_query(const SortedSpatialHash* space, Box area) {
+    Vec(uint32_t) result = NULL;
+    sorted_hash_query_into(space, area, &result);
+    return result;
+}
+
+void sorted_hash_find_pairs(const SortedSpatialHash* space, Vec(BoxPair)* pairs) {
+    // Walk the runs in sorted order rather than through the index.
+    uint32_t start = 0;
+    while (start < space->entry_count) {
+        uint64_t key = space->items[start].key;
+        uint32_t end = start + 1;
+        while (end < space->entry_count && space->items[end].key == key) {
+            end++;
+        }
+
+        for (uint32_t i = start; i < end; i++) {
+            const BoxEntry *a = &space->entries[i];
+            for (uint32_t j = i+1; j < end; j++) {
+                const BoxEntry *b = &space->entries[j];
+                if (!box_overlapp(a->box, b->box)) {
+                    continue;
+                }
+
+                // Only the cell owning the overlap's corner reports it.
+                Vec2 corner = vec2_div(box_overlapp_min(a->box, b->box), space->cell_size);
+                if (cell_key(floorf(corner.x), floorf(corner.y)) != key) {
+                    continue;
+                }
+
+                vec_push(*pairs, box_pair(a->id, b->id));
+            }
+        }
+
+        start = end;
+    }
+}
+
+void sorted_hash_debug_draw(const SortedSpatialHash* space, SDL_Renderer *renderer) {
+    int32_t vertical_count;
+    int32_t horizontal_count;
+    SDL_GetRendererOutputSize(renderer, &horizontal_count, &vertical_count);
+
+    horizontal_count /= space->cell_size.x;
+    vertical_count /= space->cell_size.y;
+
+    horizontal_count++;
+    vertical_count++;
+
+    for (int32_t y = 0; y < vertical_count; y++) {
+        for (int32_t x = 0; x < horizontal_count; x++) {
+            SDL_Rect rect = {
+                .x = x*space->cell_size.x,
+                .y = y*space->cell_size.y,
+                .w = space->cell_size.x,
+                .h = space->cell_size.y,
+            };
+            SDL_RenderDrawRect(renderer, &rect);
+        }
+    }
+}
@@ -0,0 +1,370 @@
+#include "static_rtree.h"
+#include "ds.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Every level adds at most 'STATIC_RTREE_FANOUT - 1' pending siblings and a
+// tree over 2^32 items is at most 11 levels deep.
+#define STACK_SIZE 128
+
+typedef struct Bounds Bounds;
+struct Bounds {
+    float min_x;
+    float min_y;
+    float max_x;
+    float max_y;
+};
+
+static int center_x_cmp(const void *a, const void *b) {
+    const Box *box_a = &((const BoxEntry *) a)->box;
+    const Box *box_b = &((const BoxEntry *) b)->box;
+    float x_a = box_a->pos.x + box_a->size.x*0.5f;
+    float x_b = box_b->pos.x + box_b->size.x*0.5f;
+    return (x_a > x_b) - (x_a < x_b);
+}
+
+static int center_y_cmp(const void *a, const void *b) {
+    const Box *box_a = &((const BoxEntry *) a)->box;
+    const Box *box_b = &((const BoxEntry *) b)->box;
+    float y_a = box_a->pos.y + box_a->size.y*0.5f;
+    float y_b = box_b->pos.y + box_b->size.y*0.5f;
+    return (y_a > y_b) - (y_a < y_b);
+}
+
+static uint32_t div_ceil(uint32_t a, uint32_t b) {
+    return (a + b - 1) / b;
+}
+
+// Sort-Tile-Recursive order: the entries are cut into vertical slices of
+// whole nodes by their x center, and every slice is sorted by y center. Each
+// run of 'STATIC_RTREE_FANOUT' entries then makes a node.
+static void str_sort(BoxEntry *entries, uint32_t count) {
+    const uint32_t node_count = div_ceil(count, STATIC_RTREE_FANOUT);
+    const uint32_t slice_count = ceilf(sqrtf(node_count));
+    const uint32_t slice_size = div_ceil(node_count, slice_count)*STATIC_RTREE_FANOUT;
+
+    qsort(entries, count, sizeof(BoxEntry), center_x_cmp);
+    for (uint32_t begin = 0; begin < count; begin += slice_size) {
+        uint32_t len = count - begin < slice_size ? count - begin : slice_size;
+        qsort(entries + begin, len, sizeof(BoxEntry), center_y_cmp);
+    }
+}
+
+static Bounds static_rtree_node_bounds(const StaticRTreeNode *node) {
+    Bounds bounds = {
+        .min_x = INFINITY,
+        .min_y = INFINITY,
+        .max_x = -INFINITY,
+        .max_y = -INFINITY,
+    };
+    for (uint32_t k = 0; k < node->child_count; k++) {
+        bounds.min_x = fminf(bounds.min_x, node->min_x[k]);
+        bounds.min_y = fminf(bounds.min_y, node->min_y[k]);
+        bounds.max_x = fmaxf(bounds.max_x, node->max_x[k]);
+        bounds.max_y = fmaxf(bounds.max_y, node->max_y[k]);
+    }
+    return bounds;
+}
+
+// Unused children get inverted bounds, which never overlap anything, so
+// queries can test all of them without looking at 'child_count'.
+static void static_rtree_node_init(StaticRTreeNode *node, uint32_t first_child, uint32_t child_count) {
+    node->first_child = first_child;
+    node->child_count = child_count;
+    for (uint32_t k = 0; k < STATIC_RTREE_FANOUT; k++) {
+        node->min_x[k] = INFINITY;
+        node->min_y[k] = INFINITY;
+        node->max_x[k] = -INFINITY;
+        node->max_y[k] = -INFINITY;
+    }
+}
+
+// Bit 'k' is set if child 'k' overlaps the area.
+static uint32_t static_rtree_node_overlapp(const StaticRTreeNode *node, Bounds area) {
+    uint32_t mask = 0;
+    for (uint32_t k = 0; k < STATIC_RTREE_FANOUT; k++) {
+        uint32_t overlapp = (node->max_x[k] > area.min_x) &
+                            (node->min_x[k] < area.max_x) &
+                            (node->max_y[k] > area.min_y) &
+                            (node->min_y[k] < area.max_y);
+        mask |= overlapp << k;
+    }
+    return mask;
+}
+
+static Bounds box_bounds(Box box) {
+    return (Bounds) {
+        .min_x = box.pos.x,
+        .min_y = box.pos.y,
+        .max_x = box.pos.x+box.size.x,
+        .max_y = box.pos.y+box.size.y,
+    };
+}
+
+StaticRTree* static_rtree_new(const void* desc) {
+    (void) desc;
+    StaticRTree* tree = malloc(sizeof(StaticRTree));
+    *tree = (StaticRTree) { 0 };
+    return tree;
+}
+
+void static_rtree_free(StaticRTree *tree) {
+    vec_free(tree->staged);
+    vec_free(tree->items);
+    vec_free(tree->nodes);
+    vec_free(tree->scratch);
+    vec_free(tree->level_scratch);
+    vec_free(tree->level_ends);
+    free(tree);
+}
+
+void static_rtree_insert(StaticRTree *tree, uint32_t id, Box box) {
+    BoxEntry entry = {
+        .box = box,
+        .id = id,
+    };
+    vec_push(tree->staged, entry);
+}
+
+void static_rtree_build(StaticRTree *tree) {
+    const uint32_t count = vec_len(tree->staged);
+
+    vec_clear(tree->items);
+    vec_clear(tree->nodes);
+    tree->leaf_start = 0;
+    if (count == 0) {
+        return;
+    }
+
+    vec_insert_arr(tree->items, 0, tree->staged, count);
+    str_sort(tree->items, count);
+
+    // Level sizes are known up front, so every level is written straight to
+    // its place in the breadth first order. 'level_ends' holds the end of
+    // every level, leaves first.
+    vec_clear(tree->level_ends);
+    uint32_t total = 0;
+    for (uint32_t level_count = div_ceil(count, STATIC_RTREE_FANOUT);; level_count = div_ceil(level_count, STATIC_RTREE_FANOUT)) {
+        total += level_count;
+        vec_push(tree->level_ends, level_count);
+        if (level_count == 1) {
+            break;
+        }
+    }
+    vec_insert_arr(tree->nodes, 0, NULL, total);
+
+    const uint32_t level_count = vec_len(tree->level_ends);
+    uint32_t end = total;
+    for (uint32_t level = 0; level < level_count; level++) {
+        uint32_t size = tree->level_ends[level];
+        tree->level_ends[level] = end;
+        end -= size;
+    }
+
+    // Leaves over runs of items.
+    tree->leaf_start = tree->level_ends[0] - div_ceil(count, STATIC_RTREE_FANOUT);
+    for (uint32_t first = 0; first < count; first += STATIC_RTREE_FANOUT) {
+        StaticRTreeNode *node = &tree->nodes[tree->leaf_start + first/STATIC_RTREE_FANOUT];
+        uint32_t child_count = count - first < STATIC_RTREE_FANOUT ? count - first : STATIC_RTREE_FANOUT;
+        static_rtree_node_init(node, first, child_count);
+        for (uint32_t k = 0; k < child_count; k++) {
+            Bounds bounds = box_bounds(tree->items[first + k].box);
+            node->min_x[k] = bounds.min_x;
+            node->min_y[k] = bounds.min_y;
+            node->max_x[k] = bounds.max_x;
+            node->max_y[k] = bounds.max_y;
+        }
+    }
+
+    // Every level above is packed from the one below it, after putting that
+    // one in STR order too.
+    for (uint32_t level = 1; level < level_count; level++) {
+        const uint32_t child_end = tree->level_ends[level-1];
+        const uint32_t child_begin = tree->level_ends[level];
+        const uint32_t child_count = child_end - child_begin;
+
+        vec_clear(tree->scratch);
+        vec_clear(tree->level_scratch);
+        for (uint32_t i = 0; i < child_count; i++) {
+            Bounds bounds = static_rtree_node_bounds(&tree->nodes[child_begin + i]);
+            BoxEntry entry = {
+                .box = box(bounds.min_x, bounds.min_y, bounds.max_x - bounds.min_x, bounds.max_y - bounds.min_y),
+                .id = i,
+            };
+            vec_push(tree->scratch, entry);
+        }
+        vec_insert_arr(tree->level_scratch, 0, &tree->nodes[child_begin], child_count);
+
+        str_sort(tree->scratch, child_count);
+        for (uint32_t i = 0; i < child_count; i++) {
+            tree->nodes[child_begin + i] = tree->level_scratch[tree->scratch[i].id];
+        }
+
+        const uint32_t begin = level + 1 < level_count ? tree->level_ends[level+1] : 0;
+        for (uint32_t first = 0; first < child_count; first += STATIC_RTREE_FANOUT) {
+            StaticRTreeNode *node = &tree->nodes[begin + first/STATIC_RTREE_FANOUT];
+            uint32_t node_child_count = child_count - first < STATIC_RTREE_FANOUT ? child_count - first : STATIC_RTREE_FANOUT;
+            static_rtree_node_init(node, child_begin + first, node_child_count);
+            for (uint32_t k = 0; k < node_child_count; k++) {
+                Bounds bounds = static_rtree_node_bounds(&tree->nodes[child_begin + first + k]);
+                node->min_x[k] = bounds.min_x;
+                node->min_y[k] = bounds.min_y;
+                node->max_x[k] = bounds.max_x;
+                node->max_y[k] = bounds.max_y;
+            }
+        }
+    }
+}
+
+void static_rtree_clear(StaticRTree *tree) {
+    vec_clear(tree->staged);
+    // Empty until the next build.
+    vec_clear(tree->items);
+    vec_clear(tree->nodes);
+    tree->leaf_start = 0;
+}
+
+void static_rtree_query_into(const StaticRTree* tree, Box area, Vec(uint32_t)* result) {
+    if (vec_len(tree->nodes) == 0) {
+        return;
+    }
+
+    const Bounds bounds = box_bounds(area);
+    uint32_t stack[STACK_SIZE];
+    uint32_t stack_len = 0;
+    stack[stack_len++] = 0;
+
+    while (stack_len > 0) {
+        const uint32_t node_i = stack[--stack_len];
+        const StaticRTreeNode *node = &tree->nodes[node_i];
+        uint32_t mask = static_rtree_node_overlapp(node, bounds);
+
+        if (node_i >= tree->leaf_start) {
+            while (mask) {
+                uint32_t k = __builtin_ctz(mask);
+                mask &= mask - 1;
+                vec_push(*result, tree->items[node->first_child + k].id);
+            }
+        } else {
+            while (mask) {
+                uint32_t k = __builtin_ctz(mask);
+                mask &= mask - 1;
+                stack[stack_len++] = node->first_child + k;
+            }
+        }
+    }
+}
+
+bool static_rtree_query_visit(const StaticRTree* tree, Box area, BoxVisitFunc func, void* user_data) {
+    if (vec_len(tree->nodes) == 0) {
+        return false;
+    }
+
+    const Bounds bounds = box_bounds(area);
+    uint32_t stack[STACK_SIZE];
+    uint32_t stack_len = 0;
+    stack[stack_len++] = 0;
+
+    while (stack_len > 0) {
+        const uint32_t node_i = stack[--stack_len];
+        const StaticRTreeNode *node = &tree->nodes[node_i];
+        uint32_t mask = static_rtree_node_overlapp(node, bounds);
+
+        if (node_i >= tree->leaf_start) {
+            while (mask) {
+                uint32_t k = __builtin_ctz(mask);
+                mask &= mask - 1;
+                const BoxEntry *entry = &tree->items[node->first_child + k];
+                if (func(user_data, entry->id, entry->box)) {
+                    return true;
+                }
+            }
+        } else {
+            while (mask) {
+                uint32_t k = __builtin_ctz(mask);
+                mask &= mask - 1;
+                stack[stack_len++] = node->first_child + k;
+            }
+        }
+    }
+
+    return false;
+}
+
+Vec(uint32_t) static_rtree_query(const StaticRTree* tree, Box area) {
+    Vec(uint32_t) result = NULL;
+    static_rtree_query_into(tree, area, &result);
+    return result;
+}
+
+static bool static_rtree_child_overlapp(const StaticRTreeNode *a, uint32_t ka, const StaticRTreeNode *b, uint32_t kb) {
+    return a->max_x[ka] > b->min_x[kb] &&
+           a->min_x[ka] < b->max_x[kb] &&
+           a->max_y[ka] > b->min_y[kb] &&
+           a->min_y[ka] < b->max_y[kb];
+}
+
+// All leaves are on the same level, so two nodes compared here always are
+// both leaves or both inner nodes.
+static void static_rtree_pair_nodes(const StaticRTree* tree, uint32_t a_i, uint32_t b_i, Vec(BoxPair)* pairs) {
+    const StaticRTreeNode *a = &tree->nodes[a_i];
+    const StaticRTreeNode *b = &tree->nodes[b_i];
+    const bool leaf = a_i >= tree->leaf_start;
+
+    for (uint32_t ka = 0; ka < a->child_count; ka++) {
+        for (uint32_t kb = 0; kb < b->child_count; kb++) {
+            if (!static_rtree_child_overlapp(a, ka, b, kb)) {
+                continue;
+            }
+            if (leaf) {
+                vec_push(*pairs, box_pair(tree->items[a->first_child + ka].id, tree->items[b->first_child + kb].id));
+            } else {
+                static_rtree_pair_nodes(tree, a->first_child + ka, b->first_child + kb, pairs);
+            }
+        }
+    }
+}
+
+static void static_rtree_pair_self(const StaticRTree* tree, uint32_t node_i, Vec(BoxPair)* pairs) {
+    const StaticRTreeNode *node = &tree->nodes[node_i];
+    const bool leaf = node_i >= tree->leaf_start;
+
+    for (uint32_t ka = 0; ka < node->child_count; ka++) {
+        if (!leaf) {
+            static_rtree_pair_self(tree, node->first_child + ka, pairs);
+        }
+        for (uint32_t kb = ka+1; kb < node->child_count; kb++) {
+            if (!static_rtree_child_overlapp(node, ka, node, kb)) {
+                continue;
+            }
+            if (leaf) {
+                vec_push(*pairs, box_pair(tree->items[node->first_child + ka].id, tree->items[node->first_child + kb].id));
+            } else {
+                static_rtree_pair_nodes(tree, node->first_child + ka, node->first_child + kb, pairs);
+            }
+        }
+    }
+}
+
+// Pairs inside a node come from pairs of its overlapping children, so every
+// pair is found once, at the lowest node holding both boxes.
+void static_rtree_find_pairs(const StaticRTree* tree, Vec(BoxPair)* pairs) {
+    if (vec_len(tree->nodes) == 0) {
+        return;
+    }
+    static_rtree_pair_self(tree, 0, pairs);
+}
+
+void static_rtree_debug_draw(const StaticRTree* tree, SDL_Renderer *renderer) {
+    for (size_t i = 0; i < vec_len(tree->nodes); i++) {
+        Bounds bounds = static_rtree_node_bounds(&tree->nodes[i]);
+        SDL_Rect rect = {
+            .x = bounds.min_x,
+            .y = bounds.min_y,
+            .w = bounds.max_x - bounds.min_x,
+            .h = bounds.max_y - bounds.min_y,
+        };
+        SDL_RenderDrawRect(renderer, &rect);
+    }
+}
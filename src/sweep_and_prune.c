@@ -0,0 +1,189 @@
+#include "sweep_and_prune.h"
+#include "ds.h"
+
+#include <stdlib.h>
+
+static int entry_cmp(const void *a, const void *b) {
+    float x_a = ((const BoxEntry *) a)->box.pos.x;
+    float x_b = ((const BoxEntry *) b)->box.pos.x;
+    return (x_a > x_b) - (x_a < x_b);
+}
+
+// First entry starting at or after 'x'.
+static size_t sweep_and_prune_lower_bound(const SweepAndPrune* sap, float x) {
+    size_t begin = 0;
+    size_t end = vec_len(sap->entries);
+    while (begin < end) {
+        size_t mid = begin + (end - begin)/2;
+        if (sap->entries[mid].box.pos.x < x) {
+            begin = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+    return begin;
+}
+
+SweepAndPrune* sweep_and_prune_new(const void* desc) {
+    (void) desc;
+    SweepAndPrune* sap = malloc(sizeof(SweepAndPrune));
+    *sap = (SweepAndPrune) {
+        .frame = 1,
+    };
+    return sap;
+}
+
+void sweep_and_prune_free(SweepAndPrune *sap) {
+    vec_free(sap->entries);
+    vec_free(sap->slots);
+    vec_free(sap->frames);
+    free(sap);
+}
+
+void sweep_and_prune_insert(SweepAndPrune *sap, uint32_t id, Box box) {
+    while (id >= vec_len(sap->slots)) {
+        vec_push(sap->slots, SWEEP_AND_PRUNE_NONE);
+        vec_push(sap->frames, 0);
+    }
+    sap->frames[id] = sap->frame;
+
+    // Reuse the entry from the previous frame, it's most likely still close
+    // to where it belongs in the order.
+    if (sap->slots[id] != SWEEP_AND_PRUNE_NONE) {
+        sap->entries[sap->slots[id]].box = box;
+        return;
+    }
+
+    BoxEntry entry = {
+        .box = box,
+        .id = id,
+    };
+    sap->slots[id] = vec_len(sap->entries);
+    vec_push(sap->entries, entry);
+    sap->new_count++;
+}
+
+void sweep_and_prune_update(SweepAndPrune *sap, uint32_t id, Box box) {
+    if (id >= vec_len(sap->slots) || sap->slots[id] == SWEEP_AND_PRUNE_NONE) {
+        return;
+    }
+    sap->entries[sap->slots[id]].box = box;
+}
+
+void sweep_and_prune_remove(SweepAndPrune *sap, uint32_t id) {
+    if (id >= vec_len(sap->frames)) {
+        return;
+    }
+    sap->frames[id] = 0;
+}
+
+void sweep_and_prune_clear(SweepAndPrune *sap) {
+    sap->frame++;
+}
+
+void sweep_and_prune_build(SweepAndPrune *sap) {
+    // Drop the entries that weren't inserted again, keeping the order.
+    size_t count = 0;
+    for (size_t i = 0; i < vec_len(sap->entries); i++) {
+        uint32_t id = sap->entries[i].id;
+        if (sap->frames[id] != sap->frame) {
+            sap->slots[id] = SWEEP_AND_PRUNE_NONE;
+            continue;
+        }
+        sap->entries[count++] = sap->entries[i];
+    }
+    if (count < vec_len(sap->entries)) {
+        vec_remove_arr(sap->entries, count, vec_len(sap->entries) - count, NULL);
+    }
+
+    // Insertion sort is close to linear when boxes barely moved since the
+    // last build, but not when a lot of boxes were just appended.
+    if (sap->new_count > count/8) {
+        qsort(sap->entries, count, sizeof(BoxEntry), entry_cmp);
+    } else {
+        for (size_t i = 1; i < count; i++) {
+            BoxEntry entry = sap->entries[i];
+            size_t j = i;
+            while (j > 0 && sap->entries[j-1].box.pos.x > entry.box.pos.x) {
+                sap->entries[j] = sap->entries[j-1];
+                j--;
+            }
+            sap->entries[j] = entry;
+        }
+    }
+    sap->new_count = 0;
+
+    sap->max_width = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+        sap->slots[sap->entries[i].id] = i;
+        if (sap->entries[i].box.size.x > sap->max_width) {
+            sap->max_width = sap->entries[i].box.size.x;
+        }
+    }
+}
+
+void sweep_and_prune_query_into(const SweepAndPrune* sap, Box area, Vec(uint32_t)* result) {
+    const float end_x = area.pos.x + area.size.x;
+    for (size_t i = sweep_and_prune_lower_bound(sap, area.pos.x - sap->max_width); i < vec_len(sap->entries); i++) {
+        const BoxEntry *entry = &sap->entries[i];
+        if (entry->box.pos.x >= end_x) {
+            break;
+        }
+        if (box_overlapp(entry->box, area)) {
+            vec_push(*result, entry->id);
+        }
+    }
+}
+
+bool sweep_and_prune_query_visit(const SweepAndPrune* sap, Box area, BoxVisitFunc func, void* user_data) {
+    const float end_x = area.pos.x + area.size.x;
+    for (size_t i = sweep_and_prune_lower_bound(sap, area.pos.x - sap->max_width); i < vec_len(sap->entries); i++) {
+        const BoxEntry *entry = &sap->entries[i];
+        if (entry->box.pos.x >= end_x) {
+            break;
+        }
+        if (box_overlapp(entry->box, area) && func(user_data, entry->id, entry->box)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+Vec(uint32_t) sweep_and_prune_query(const SweepAndPrune* sap, Box area) {
+    Vec(uint32_t) result = NULL;
+    sweep_and_prune_query_into(sap, area, &result);
+    return result;
+}
+
+// Every box is only compared with the boxes starting before it ends on the
+// x axis.
+void sweep_and_prune_find_pairs(const SweepAndPrune* sap, Vec(BoxPair)* pairs) {
+    const size_t count = vec_len(sap->entries);
+    for (size_t i = 0; i < count; i++) {
+        const BoxEntry *a = &sap->entries[i];
+        const float end_x = a->box.pos.x + a->box.size.x;
+        for (size_t j = i+1; j < count && sap->entries[j].box.pos.x < end_x; j++) {
+            const BoxEntry *b = &sap->entries[j];
+            if (box_overlapp(a->box, b->box)) {
+                vec_push(*pairs, box_pair(a->id, b->id));
+            }
+        }
+    }
+}
+
+// There's no partition to draw, so this draws the interval every entry covers
+// on the sweep axis. Consecutive entries go on different rows along the top
+// so overlapping intervals stay apart.
+void sweep_and_prune_debug_draw(const SweepAndPrune* sap, SDL_Renderer *renderer) {
+    for (size_t i = 0; i < vec_len(sap->entries); i++) {
+        const BoxEntry *entry = &sap->entries[i];
+        SDL_FRect rect = {
+            .x = entry->box.pos.x,
+            .y = (i % SWEEP_AND_PRUNE_DRAW_ROWS) * 4.0f,
+            .w = entry->box.size.x,
+            .h = 2.0f,
+        };
+        SDL_RenderDrawRectF(renderer, &rect);
+    }
+}
@@ -0,0 +1,119 @@
+#include "thread_pool.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+static void thread_pool_work(ThreadPool *pool, uint32_t thread) {
+    while (true) {
+        uint32_t task = __atomic_fetch_add(&pool->next_task, 1, __ATOMIC_RELAXED);
+        if (task >= pool->task_count) {
+            break;
+        }
+        pool->func(pool->user_data, task, thread);
+    }
+}
+
+static void* thread_pool_worker_main(void* arg) {
+    ThreadPoolWorker *worker = arg;
+    ThreadPool *pool = worker->pool;
+    uint32_t generation = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (true) {
+        while (!pool->quit && pool->generation == generation) {
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        }
+        if (pool->quit) {
+            break;
+        }
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->mutex);
+
+        thread_pool_work(pool, worker->index);
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->working--;
+        if (pool->working == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+ThreadPool* thread_pool_new(uint32_t thread_count) {
+    if (thread_count == 0) {
+        long core_count = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = core_count > 0 ? core_count : 1;
+    }
+
+    ThreadPool* pool = malloc(sizeof(ThreadPool));
+    *pool = (ThreadPool) {
+        .thread_count = thread_count,
+    };
+    pthread_mutex_init(&pool->batch_mutex, NULL);
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    // Thread 0 is whoever calls 'thread_pool_run'.
+    pool->workers = malloc(thread_count * sizeof(ThreadPoolWorker));
+    for (uint32_t i = 1; i < thread_count; i++) {
+        pool->workers[i] = (ThreadPoolWorker) {
+            .pool = pool,
+            .index = i,
+        };
+        pthread_create(&pool->workers[i].thread, NULL, thread_pool_worker_main, &pool->workers[i]);
+    }
+
+    return pool;
+}
+
+void thread_pool_free(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (uint32_t i = 1; i < pool->thread_count; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_mutex_destroy(&pool->batch_mutex);
+    free(pool->workers);
+    free(pool);
+}
+
+void thread_pool_run(ThreadPool *pool, ThreadPoolTaskFunc func, void* user_data, uint32_t task_count) {
+    // Waking the workers isn't worth it for a single task.
+    if (pool->thread_count == 1 || task_count <= 1) {
+        for (uint32_t task = 0; task < task_count; task++) {
+            func(user_data, task, 0);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->batch_mutex);
+    pthread_mutex_lock(&pool->mutex);
+    pool->func = func;
+    pool->user_data = user_data;
+    pool->task_count = task_count;
+    pool->next_task = 0;
+    pool->working = pool->thread_count - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    thread_pool_work(pool, 0);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->working > 0) {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    pthread_mutex_unlock(&pool->batch_mutex);
+}